@@ -0,0 +1,10 @@
+#pragma once
+
+#include "../include/resman.h"
+
+// The files are generated into the build directory when the benchmarks are configured
+namespace bench {
+	constexpr resman::Resource<1> gSmall("small.bin");
+	constexpr resman::Resource<2> gLarge("large.bin");
+	constexpr resman::Resource<3, resman::Compressed> gLargeCompressed("large.bin");
+}
@@ -0,0 +1,82 @@
+// Microbenchmarks of the runtime access path, compared with a loop over a plain pointer.
+// Prints one JSON object per line, or appends them to the file given as the only argument:
+//   {"benchmark":"handle","case":"iterate_handle","resource_bytes":1048576,"iterations":2000,"ns_per_op":41210.5}
+#include "benchdefs.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+using namespace resman;
+
+// Keeps the compiler from optimizing the measured work away
+static volatile std::uint64_t sink;
+static std::FILE* results = stdout;
+
+template <typename F>
+static void run(const char* name, std::size_t resourceBytes, std::uint64_t iterations, F op) {
+	op(); // warm up, page in the data and decompress what is compressed
+
+	auto start = std::chrono::steady_clock::now();
+	for (std::uint64_t i = 0; i < iterations; ++i) {
+		op();
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::fprintf(results, "{\"benchmark\":\"handle\",\"case\":\"%s\",\"resource_bytes\":%zu,\"iterations\":%llu,\"ns_per_op\":%.3f}\n",
+		name, resourceBytes, static_cast<unsigned long long>(iterations), elapsed.count() / iterations);
+}
+
+static std::uint64_t sumRaw(const char* data, std::size_t size) {
+	std::uint64_t sum = 0;
+	for (const char* p = data; p != data + size; ++p) {
+		sum += static_cast<unsigned char>(*p);
+	}
+	return sum;
+}
+
+static std::uint64_t sumHandle(ResourceHandle& handle) {
+	std::uint64_t sum = 0;
+	for (char c : handle) {
+		sum += static_cast<unsigned char>(c);
+	}
+	return sum;
+}
+
+template <typename R>
+static void benchIteration(const char* rawName, const char* handleName, R resource, std::uint64_t iterations) {
+	ResourceHandle handle(resource);
+
+	// the raw loop gets the same bytes, but the compiler cannot see where they come from
+	const char* volatile rawData = handle.begin();
+	volatile std::size_t rawSize = handle.size();
+	run(rawName, handle.size(), iterations, [&] {
+		sink += sumRaw(rawData, rawSize);
+	});
+	run(handleName, handle.size(), iterations, [&] {
+		sink += sumHandle(handle);
+	});
+}
+
+int main(int argc, char* argv[]) {
+	if (argc > 1 && !(results = std::fopen(argv[1], "a"))) {
+		std::perror(argv[1]);
+		return 1;
+	}
+
+	run("construct_handle", ResourceHandle(bench::gSmall).size(), 10000000, [] {
+		ResourceHandle handle(bench::gSmall);
+		sink += handle.size();
+	});
+	run("construct_handle_compressed", ResourceHandle(bench::gLargeCompressed).size(), 10000000, [] {
+		ResourceHandle handle(bench::gLargeCompressed);
+		sink += handle.size();
+	});
+
+	benchIteration("iterate_raw_small", "iterate_handle_small", bench::gSmall, 10000000);
+	benchIteration("iterate_raw_large", "iterate_handle_large", bench::gLarge, 2000);
+	benchIteration("iterate_raw_compressed", "iterate_handle_compressed", bench::gLargeCompressed, 2000);
+
+	std::fclose(results);
+	return 0;
+}
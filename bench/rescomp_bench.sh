@@ -0,0 +1,135 @@
+#!/bin/bash
+# Measures how rescomp scales with the number of resources, their size and the number of input headers.
+# Every combination is compiled in each output mode and reported as one JSON object per line:
+#   {"benchmark":"rescomp","mode":"obj","resources":100,"resource_bytes":1024,"headers":8,
+#    "wall_seconds":0.52,"peak_rss_kb":81234,"output_bytes":204800,
+#    "phases":{"add_data":{"count":100,"seconds":0.08,"bytes":102400},"codegen":{...},...}}
+# Times and peak RSS are taken from the -phase-stats report of each run; the seconds of a phase
+# are summed over its events, which may overlap when rescomp runs jobs in parallel.
+#
+# usage: bench/rescomp_bench.sh [options] <path/to/rescomp>
+#   -n "<counts>"  resource counts (default: "1 10 100 1000 10000")
+#   -s "<sizes>"   size of each resource, K/M/G suffixes allowed (default: "1K 64K 1M 64M")
+#   -f "<counts>"  numbers of input headers the resources are spread over (default: "1 8 32")
+#   -m "<modes>"   output modes: obj (LLVM code generation), direct (-direct), lib (static library, -j 0)
+#                  (default: "obj direct lib")
+#   -b <size>      skip combinations with more resource data in total (default: 2G)
+#   -o <file>      append results to a file instead of printing them
+
+set -e
+
+COUNTS="1 10 100 1000 10000"
+SIZES="1K 64K 1M 64M"
+HEADER_COUNTS="1 8 32"
+MODES="obj direct lib"
+BUDGET="2G"
+RESULTS=""
+
+usage() {
+	sed -n 's/^# \{0,1\}//; 9,17p' "$0" >&2
+	exit 1
+}
+
+while getopts "n:s:f:m:b:o:" OPT; do
+	case "$OPT" in
+	n) COUNTS="$OPTARG" ;;
+	s) SIZES="$OPTARG" ;;
+	f) HEADER_COUNTS="$OPTARG" ;;
+	m) MODES="$OPTARG" ;;
+	b) BUDGET="$OPTARG" ;;
+	o) RESULTS="$OPTARG" ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+RESCOMP="$1"
+if [ ! -x "$RESCOMP" ]; then
+	usage
+fi
+
+to_bytes() {
+	local VALUE="${1%[KkMmGg]}"
+	case "$1" in
+	*[Kk]) echo $((VALUE * 1024)) ;;
+	*[Mm]) echo $((VALUE * 1024 * 1024)) ;;
+	*[Gg]) echo $((VALUE * 1024 * 1024 * 1024)) ;;
+	*) echo "$1" ;;
+	esac
+}
+
+file_size() {
+	stat -c %s "$1" 2> /dev/null || stat -f %z "$1"
+}
+
+# Runs rescomp with the given arguments and sets WALL_SECONDS, PEAK_RSS_KB and PHASES from its -phase-stats report
+measure() {
+	rm -f "$WORK_DIR/stats.json"
+	"$RESCOMP" "$@" -phase-stats="$WORK_DIR/stats.json" > /dev/null
+	# the report is written by rescomp itself, one phase per line and no braces in phase names
+	local STATS
+	STATS=$(tr -d ' \n' < "$WORK_DIR/stats.json")
+	WALL_SECONDS=$(echo "$STATS" | sed 's/.*"wall_seconds":\([0-9.]*\),.*/\1/')
+	PEAK_RSS_KB=$(echo "$STATS" | sed 's/.*"peak_rss_kb":\([0-9]*\),.*/\1/')
+	PHASES=$(echo "$STATS" | sed 's/.*"phases":\({.*}\),"events".*/\1/')
+}
+
+INCLUDE_DIR="$(cd "$(dirname "$0")/../include" && pwd)"
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+# a running rescomp server would report its own memory and answer from its caches
+unset RESCOMP_SERVER
+
+BUDGET_BYTES=$(to_bytes "$BUDGET")
+if [ -n "$RESULTS" ]; then
+	exec >> "$RESULTS"
+fi
+
+for COUNT in $COUNTS; do
+	for SIZE in $SIZES; do
+		SIZE_BYTES=$(to_bytes "$SIZE")
+		if [ $((COUNT * SIZE_BYTES)) -gt "$BUDGET_BYTES" ]; then
+			echo "skipping $COUNT x $SIZE, over the $BUDGET budget" >&2
+			continue
+		fi
+
+		# Random contents, so that resources are neither deduplicated nor compressible
+		DATA_DIR="$WORK_DIR/data"
+		rm -rf "$DATA_DIR"
+		mkdir -p "$DATA_DIR"
+		head -c $((COUNT * SIZE_BYTES)) /dev/urandom | (cd "$DATA_DIR" && split -a 5 -b "$SIZE_BYTES" - res)
+		FILES=("$DATA_DIR"/res*)
+
+		for HEADERS in $HEADER_COUNTS; do
+			if [ "$HEADERS" -gt "$COUNT" ]; then
+				continue
+			fi
+
+			# Resources are spread over the headers round-robin
+			HEADER_FILES=()
+			for ((h = 0; h < HEADERS; h++)); do
+				HEADER_FILES+=("$DATA_DIR/resdefs$h.h")
+				echo '#include "resman.h"' > "${HEADER_FILES[h]}"
+			done
+			for ((i = 0; i < COUNT; i++)); do
+				echo "constexpr resman::Resource<$((i + 1))> gRes$((i + 1))(\"$(basename "${FILES[i]}")\");" \
+					>> "${HEADER_FILES[i % HEADERS]}"
+			done
+
+			for MODE in $MODES; do
+				case "$MODE" in
+				obj) OUTPUT="$WORK_DIR/out.o"; EXTRA=() ;;
+				direct) OUTPUT="$WORK_DIR/out.o"; EXTRA=(-direct) ;;
+				lib) OUTPUT="$WORK_DIR/out.a"; EXTRA=(-j 0) ;;
+				*) echo "unknown mode $MODE" >&2; exit 1 ;;
+				esac
+				rm -f "$OUTPUT"
+
+				measure "${HEADER_FILES[@]}" -o "$OUTPUT" -I "$INCLUDE_DIR" "${EXTRA[@]}"
+				echo "{\"benchmark\":\"rescomp\",\"mode\":\"$MODE\",\"resources\":$COUNT,\"resource_bytes\":$SIZE_BYTES," \
+					"\"headers\":$HEADERS,\"wall_seconds\":$WALL_SECONDS,\"peak_rss_kb\":$PEAK_RSS_KB," \
+					"\"output_bytes\":$(file_size "$OUTPUT"),\"phases\":$PHASES}" | tr -d ' '
+			done
+		done
+	done
+done
@@ -0,0 +1,74 @@
+# Helper for compiling resource headers with rescomp
+#
+# rescomp_compile(OUTPUT <file.o|file.a|file.rpak>
+#                 HEADERS <header> [<header> ...]
+#                 [RESOURCE_DIRS <dir> ...]
+#                 [INCLUDE_DIRS <dir> ...]
+#                 [TRAITS_HEADER <header>]
+#                 [OPTIONS <arg> ...])
+#
+# The RESCOMP variable must point to the rescomp executable.
+# Where the generator supports it, rescomp writes a dependency file listing every
+# included header and every embedded resource, so the output is rebuilt exactly
+# when one of them changes.
+#
+# A pack file output (.rpak) also produces a loader object with the same name
+# (file.o or file.obj), which has to be linked into the program. It is declared
+# as a byproduct and only rewritten when the pack layout changes, so Ninja does
+# not relink the program when only resource contents change.
+#
+# TRAITS_HEADER writes resman::resource_traits for every resource (-traits-header).
+# It is a byproduct as well, rescomp leaves it untouched if it does not change.
+
+include(CMakeParseArguments)
+
+function(rescomp_compile)
+	cmake_parse_arguments(RC "" "OUTPUT;TRAITS_HEADER" "HEADERS;RESOURCE_DIRS;INCLUDE_DIRS;OPTIONS" ${ARGN})
+
+	if(NOT RESCOMP)
+		message(FATAL_ERROR "rescomp_compile: RESCOMP is not set")
+	endif()
+	if(NOT RC_OUTPUT OR NOT RC_HEADERS)
+		message(FATAL_ERROR "rescomp_compile: OUTPUT and HEADERS are required")
+	endif()
+
+	set(RC_ARGS ${RC_HEADERS} -o ${RC_OUTPUT})
+	foreach(DIR ${RC_RESOURCE_DIRS})
+		list(APPEND RC_ARGS -R ${DIR})
+	endforeach()
+	foreach(DIR ${RC_INCLUDE_DIRS})
+		list(APPEND RC_ARGS -I ${DIR})
+	endforeach()
+	list(APPEND RC_ARGS ${RC_OPTIONS})
+
+	set(RC_BYPRODUCTS)
+	if(RC_OUTPUT MATCHES "\\.rpak$")
+		string(REGEX REPLACE "\\.rpak$" "${CMAKE_CXX_OUTPUT_EXTENSION}" RC_LOADER ${RC_OUTPUT})
+		list(APPEND RC_BYPRODUCTS ${RC_LOADER})
+	endif()
+	if(RC_TRAITS_HEADER)
+		list(APPEND RC_ARGS -traits-header ${RC_TRAITS_HEADER})
+		list(APPEND RC_BYPRODUCTS ${RC_TRAITS_HEADER})
+	endif()
+	if(RC_BYPRODUCTS)
+		set(RC_BYPRODUCTS BYPRODUCTS ${RC_BYPRODUCTS})
+	endif()
+
+	# DEPFILE is supported by Ninja since CMake 3.7 and by all generators since CMake 3.20
+	if((CMAKE_GENERATOR MATCHES "Ninja" AND NOT CMAKE_VERSION VERSION_LESS 3.7)
+		OR NOT CMAKE_VERSION VERSION_LESS 3.20)
+		set(RC_DEPFILE ${RC_OUTPUT}.d)
+		add_custom_command(OUTPUT ${RC_OUTPUT}
+			${RC_BYPRODUCTS}
+			COMMAND ${RESCOMP} ${RC_ARGS} -MF ${RC_DEPFILE} --
+			DEPENDS ${RC_HEADERS}
+			DEPFILE ${RC_DEPFILE}
+			VERBATIM)
+	else()
+		add_custom_command(OUTPUT ${RC_OUTPUT}
+			${RC_BYPRODUCTS}
+			COMMAND ${RESCOMP} ${RC_ARGS} --
+			DEPENDS ${RC_HEADERS}
+			VERBATIM)
+	endif()
+endfunction()
@@ -0,0 +1,322 @@
+#include "declscan.h"
+#include <cctype>
+#include <limits>
+
+using namespace llvm;
+
+namespace {
+
+enum class TokenKind {
+	Identifier, Number, String, Punctuation, Directive, End, Invalid
+};
+
+struct Token {
+	TokenKind kind;
+	StringRef text; // string literals without the quotes, directives without the '#'
+};
+
+// Tokenizer for the subset of C++ the canonical declarations use
+class DeclLexer {
+	StringRef buffer;
+	size_t pos = 0;
+	bool atLineStart = true;
+
+	char peek(size_t offset = 0) const {
+		return pos + offset < buffer.size() ? buffer[pos + offset] : '\0';
+	}
+
+	// Whitespace and comments, returns false on constructs Clang would treat differently
+	bool skipTrivia() {
+		while (pos < buffer.size()) {
+			char c = peek();
+			if (c == '\n') {
+				++pos;
+				atLineStart = true;
+			}
+			else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+				++pos;
+			}
+			else if (c == '/' && peek(1) == '/') {
+				size_t end = buffer.find('\n', pos);
+				StringRef comment = buffer.slice(pos, end);
+				if (comment.rtrim("\r").endswith("\\")) {
+					return false; // continued on the next line
+				}
+				pos = end == StringRef::npos ? buffer.size() : end;
+			}
+			else if (c == '/' && peek(1) == '*') {
+				size_t end = buffer.find("*/", pos + 2);
+				if (end == StringRef::npos) {
+					return false;
+				}
+				pos = end + 2;
+			}
+			else if (c == '\\') {
+				return false; // line splice
+			}
+			else {
+				break;
+			}
+		}
+		return true;
+	}
+
+public:
+	explicit DeclLexer(StringRef contents) : buffer(contents) {
+		if (buffer.startswith("\xEF\xBB\xBF")) {
+			pos = 3; // UTF-8 byte order mark
+		}
+	}
+
+	Token next() {
+		if (!skipTrivia()) {
+			return { TokenKind::Invalid, "" };
+		}
+		if (pos == buffer.size()) {
+			return { TokenKind::End, "" };
+		}
+
+		char c = peek();
+		size_t start = pos;
+
+		// a directive is returned as a whole line
+		if (c == '#' && atLineStart) {
+			size_t end = buffer.find('\n', pos);
+			StringRef directive = buffer.slice(pos + 1, end);
+			if (directive.find('\\') != StringRef::npos || directive.find("/*") != StringRef::npos) {
+				return { TokenKind::Invalid, "" };
+			}
+			size_t comment = directive.find("//");
+			pos = end == StringRef::npos ? buffer.size() : end;
+			return { TokenKind::Directive, directive.substr(0, comment).trim() };
+		}
+		atLineStart = false;
+
+		if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+			while (std::isalnum(static_cast<unsigned char>(peek())) || peek() == '_') {
+				++pos;
+			}
+			// u8"..." and other prefixed literals are followed by a quote
+			if (peek() == '"' || peek() == '\'') {
+				return { TokenKind::Invalid, "" };
+			}
+			return { TokenKind::Identifier, buffer.slice(start, pos) };
+		}
+
+		if (std::isdigit(static_cast<unsigned char>(c))) {
+			// digit separators and exponents are left to Clang
+			while (std::isalnum(static_cast<unsigned char>(peek()))) {
+				++pos;
+			}
+			if (peek() == '\'' || peek() == '.') {
+				return { TokenKind::Invalid, "" };
+			}
+			return { TokenKind::Number, buffer.slice(start, pos) };
+		}
+
+		if (c == '"') {
+			// plain characters only, escape sequences are left to Clang
+			size_t end = buffer.find_first_of("\"\\\n", pos + 1);
+			if (end == StringRef::npos || buffer[end] != '"') {
+				return { TokenKind::Invalid, "" };
+			}
+			pos = end + 1;
+			return { TokenKind::String, buffer.slice(start + 1, end) };
+		}
+
+		if (c == ':' && peek(1) == ':') {
+			pos += 2;
+			return { TokenKind::Punctuation, buffer.slice(start, pos) };
+		}
+		if (StringRef("<>(){};").find(c) != StringRef::npos) {
+			++pos;
+			return { TokenKind::Punctuation, buffer.slice(start, pos) };
+		}
+		return { TokenKind::Invalid, "" };
+	}
+};
+
+// Integer literal as a template argument of type unsigned, with an optional u suffix
+bool parseResourceId(StringRef literal, uint64_t& id) {
+	if (literal.endswith("u") || literal.endswith("U")) {
+		literal = literal.drop_back();
+	}
+	// getAsInteger recognizes the 0x, 0b and 0 (octal) prefixes like C++
+	return !literal.getAsInteger(0, id) && id <= std::numeric_limits<uint32_t>::max();
+}
+
+class DeclScanner {
+	DeclLexer lexer;
+	Token token;
+	ScannedHeader& result;
+	unsigned namespaceDepth = 0;
+	unsigned guardDepth = 0; // #ifndef of an include guard
+
+	void advance() {
+		token = lexer.next();
+	}
+
+	bool accept(TokenKind kind, StringRef text) {
+		if (token.kind != kind || token.text != text) {
+			return false;
+		}
+		advance();
+		return true;
+	}
+
+	bool acceptPunct(StringRef text) {
+		return accept(TokenKind::Punctuation, text);
+	}
+
+	bool acceptIdentifier(StringRef text) {
+		return accept(TokenKind::Identifier, text);
+	}
+
+	bool isIdentifier(StringRef text) const {
+		return text.size() && (std::isalpha(static_cast<unsigned char>(text[0])) || text[0] == '_')
+			&& text.find_if_not([](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; }) == StringRef::npos;
+	}
+
+	bool directive() {
+		StringRef text = token.text;
+		StringRef name = text.take_while([](char c) { return std::isalpha(static_cast<unsigned char>(c)); });
+		StringRef rest = text.drop_front(name.size()).trim();
+		advance();
+
+		if (name == "pragma") {
+			return rest == "once";
+		}
+		if (name == "include") {
+			if (rest == "\"resman.h\"" || rest == "<resman.h>") {
+				if (!result.includesResman) {
+					result.includesResman = true;
+					result.angledInclude = rest.front() == '<';
+				}
+				return true;
+			}
+			return false;
+		}
+		// only an include guard around the whole header: #ifndef G directly followed by #define G,
+		// any other macro could change what Clang sees
+		if (name == "ifndef" && namespaceDepth == 0 && result.resources.empty() && isIdentifier(rest)) {
+			if (token.kind != TokenKind::Directive) {
+				return false;
+			}
+			StringRef next = token.text;
+			if (!next.consume_front("define") || next.empty() || !std::isspace(static_cast<unsigned char>(next.front()))
+				|| next.trim() != rest) {
+				return false;
+			}
+			advance();
+			++guardDepth;
+			return true;
+		}
+		if (name == "endif" && guardDepth && namespaceDepth == 0) {
+			--guardDepth;
+			return true;
+		}
+		return false;
+	}
+
+	bool namespaceDecl() {
+		// namespace a { or namespace a::b {
+		if (token.kind != TokenKind::Identifier) {
+			return false;
+		}
+		advance();
+		while (acceptPunct("::")) {
+			if (token.kind != TokenKind::Identifier) {
+				return false;
+			}
+			advance();
+		}
+		if (!acceptPunct("{")) {
+			return false;
+		}
+		++namespaceDepth;
+		return true;
+	}
+
+	// constexpr [static|inline] resman::Resource<N> name("path"); with the specifiers in any order
+	bool resourceDecl() {
+		bool isConstexpr = false;
+		while (token.kind == TokenKind::Identifier
+			&& (token.text == "constexpr" || token.text == "static" || token.text == "inline")) {
+			isConstexpr |= token.text == "constexpr";
+			advance();
+		}
+		if (!isConstexpr || !result.includesResman) {
+			return false;
+		}
+
+		acceptPunct("::");
+		if (!acceptIdentifier("resman") || !acceptPunct("::") || !acceptIdentifier("Resource") || !acceptPunct("<")) {
+			return false;
+		}
+
+		uint64_t id;
+		if (token.kind != TokenKind::Number || !parseResourceId(token.text, id)) {
+			return false;
+		}
+		advance();
+		if (!acceptPunct(">") || token.kind != TokenKind::Identifier) {
+			return false;
+		}
+		advance();
+
+		bool braces = token.kind == TokenKind::Punctuation && token.text == "{";
+		if (!acceptPunct(braces ? "{" : "(") || token.kind != TokenKind::String) {
+			return false;
+		}
+		std::string path = token.text.str();
+		advance();
+		if (!acceptPunct(braces ? "}" : ")") || !acceptPunct(";")) {
+			return false;
+		}
+
+		result.resources.push_back({ id, std::move(path) });
+		return true;
+	}
+
+public:
+	DeclScanner(StringRef contents, ScannedHeader& result) : lexer(contents), result(result) {
+		advance();
+	}
+
+	bool scan() {
+		while (token.kind != TokenKind::End) {
+			bool ok;
+			if (token.kind == TokenKind::Directive) {
+				ok = directive();
+			}
+			else if (acceptIdentifier("namespace")) {
+				ok = namespaceDecl();
+			}
+			else if (namespaceDepth && acceptPunct("}")) {
+				--namespaceDepth;
+				ok = true;
+			}
+			else {
+				ok = resourceDecl();
+			}
+
+			if (!ok) {
+				return false;
+			}
+		}
+		return namespaceDepth == 0 && guardDepth == 0;
+	}
+};
+
+}
+
+bool scanResourceHeader(StringRef contents, ScannedHeader& result) {
+	result = ScannedHeader();
+	return DeclScanner(contents, result).scan();
+}
+
+StorageNames getItaniumStorageNames(uint64_t id) {
+	// resman::Resource<id> with an empty Options pack
+	std::string prefix = "_ZN6resman8ResourceILj" + std::to_string(id) + "EJEE";
+	return { prefix + "13storage_beginE", prefix + "12storage_sizeE", "", prefix + "12storage_hashE", prefix + "17storage_alignmentE" };
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "resource.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <llvm/ADT/StringRef.h>
+
+// Fast path for resource headers which contain nothing but canonical declarations:
+//   #pragma once / include guard
+//   #include "resman.h" (or <resman.h>)
+//   [namespace ns {]
+//   constexpr resman::Resource<N> name("path");
+//   [}]
+// Anything else (other includes or directives, options of Resource, expressions,
+// escape sequences, ...) makes the scan fail and the header is parsed by Clang instead.
+
+struct ScannedResource {
+	uint64_t id;
+	std::string declaredPath;
+};
+
+struct ScannedHeader {
+	std::vector<ScannedResource> resources;
+	bool includesResman = false;
+	bool angledInclude = false; // <resman.h>
+};
+
+// Returns false if the header is not made of canonical declarations only
+bool scanResourceHeader(llvm::StringRef contents, ScannedHeader& result);
+
+// Storage names of Resource<id> without options in the Itanium C++ ABI
+StorageNames getItaniumStorageNames(uint64_t id);
@@ -0,0 +1,38 @@
+#include "depfile.h"
+#include "exceptions.h"
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+static void writeEscaped(raw_ostream& os, StringRef path) {
+	for (char c : path) {
+		switch (c) {
+		case ' ':
+		case '#':
+			os << '\\' << c;
+			break;
+		case '$':
+			os << "$$";
+			break;
+		default:
+			os << c;
+		}
+	}
+}
+
+void writeDepFile(const std::string& depFilePath, const std::string& target, const std::vector<std::string>& deps) {
+	std::error_code errc;
+	raw_fd_ostream os(depFilePath, errc, sys::fs::F_Text);
+	if (errc) {
+		throw llvm_ec_error(errc, "Cannot open dependency file: ");
+	}
+
+	writeEscaped(os, target);
+	os << ':';
+	for (const auto& dep : deps) {
+		os << " \\\n  ";
+		writeEscaped(os, dep);
+	}
+	os << '\n';
+}
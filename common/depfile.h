@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Write a dependency file in the Makefile syntax understood by both Make and Ninja
+void writeDepFile(const std::string& depFilePath, const std::string& target, const std::vector<std::string>& deps);
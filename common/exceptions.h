@@ -6,7 +6,7 @@
 #include <exception>
 #include <system_error>
 
-class llvm_error : std::exception {
+class llvm_error : public std::exception {
 	llvm::Error err;
 	std::string prefix;
 
@@ -21,19 +21,19 @@ public:
 	}
 };
 
-class llvm_ec_error : llvm_error {
+class llvm_ec_error : public llvm_error {
 public:
 	llvm_ec_error(std::error_code errc, const char* msg_prefix = "")
 	: llvm_error(llvm::errorCodeToError(errc), msg_prefix) {}
 };
 
-class llvm_string_error : llvm_error {
+class llvm_string_error : public llvm_error {
 public:
 	llvm_string_error(const std::string& msg, const char* msg_prefix = "")
 	: llvm_error(llvm::make_error<llvm::StringError>(msg, std::error_code{}), msg_prefix) {}
 };
 
-class filetype_error : llvm_string_error {
+class filetype_error : public llvm_string_error {
 public:
 	filetype_error(const std::string& msg)
 	: llvm_string_error(msg, "Invalid file type: ") {}
@@ -1,34 +1,60 @@
 #include "fileio.h"
 #include "fsutil.h"
+#include "phasestats.h"
 #include <fstream>
 #include <utility>
+#include <llvm/ADT/SmallString.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
 
 using namespace llvm;
 
-Expected<std::vector<char>> readFileIntoMemory(const std::string& ifname, const std::vector<StringRef>& searchPath) {
-	auto errorOrMemBuf = MemoryBuffer::getFile(ifname, -1, false); // is the file in the current directory?
-	if (errorOrMemBuf) {
-		auto& memBuf = *errorOrMemBuf;
-		return std::vector<char>{ memBuf->getBufferStart(), memBuf->getBufferEnd() };
+static std::error_code checkRegularFile(const Twine& path) {
+	sys::fs::file_status status;
+	if (auto errc = sys::fs::status(path, status)) {
+		return errc;
 	}
-	std::error_code lastError = errorOrMemBuf.getError();
+	if (sys::fs::is_directory(status)) {
+		return std::make_error_code(std::errc::is_a_directory);
+	}
+	return {};
+}
 
-	StashCWD restoreCwdOnScopeExit;
+Expected<std::string> findResourceFile(const std::string& ifname, ArrayRef<StringRef> searchPath) {
+	std::error_code lastError = checkRegularFile(ifname); // is the file in the current directory?
+	if (!lastError) {
+		return makeAbsolute(ifname);
+	}
 
+	// Resolve against the search path without changing the working directory,
+	// so that lookups can safely run from several threads.
 	for (StringRef dir : searchPath) { // if not, try search path
-		//llvm::outs() << "Searching input in " << dir << "\n";
-		sys::fs::set_current_path(dir);
+		SmallString<260> candidate{dir};
+		sys::path::append(candidate, ifname);
 
-		auto errorOrMemBuf = MemoryBuffer::getFile(ifname, -1, false);
-		if (!errorOrMemBuf) {
-			lastError = errorOrMemBuf.getError();
-			continue;
+		lastError = checkRegularFile(candidate);
+		if (!lastError) {
+			return makeAbsolute(candidate);
 		}
-		auto& memBuf = *errorOrMemBuf;
-		return std::vector<char>{ memBuf->getBufferStart(), memBuf->getBufferEnd() };
 	}
 
 	return errorCodeToError(lastError);
 }
+
+Expected<std::unique_ptr<MemoryBuffer>> readFileIntoMemory(const std::string& ifname, ArrayRef<StringRef> searchPath) {
+	auto expectedPath = findResourceFile(ifname, searchPath);
+	if (!expectedPath) {
+		return expectedPath.takeError();
+	}
+
+	PhaseStats::Scope phase("read", *expectedPath);
+
+	// No null terminator is required, so that getFile is free to mmap the file
+	auto errorOrMemBuf = MemoryBuffer::getFile(*expectedPath, -1, false);
+	if (!errorOrMemBuf) {
+		return errorCodeToError(errorOrMemBuf.getError());
+	}
+	phase.setBytes((*errorOrMemBuf)->getBufferSize());
+	return std::move(*errorOrMemBuf);
+}
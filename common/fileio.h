@@ -1,8 +1,14 @@
 #pragma once
 
-#include <vector>
+#include <memory>
 #include <string>
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/StringRef.h>
 #include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
 
-llvm::Expected<std::vector<char>> readFileIntoMemory(const std::string& ifname, const std::vector<llvm::StringRef>& searchPath = {});
\ No newline at end of file
+// Returns absolute path of the first match in the current directory or the search path
+llvm::Expected<std::string> findResourceFile(const std::string& ifname, llvm::ArrayRef<llvm::StringRef> searchPath = {});
+
+// Large files are memory-mapped rather than read, the returned buffer owns the mapping
+llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> readFileIntoMemory(const std::string& ifname, llvm::ArrayRef<llvm::StringRef> searchPath = {});
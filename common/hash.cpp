@@ -0,0 +1,112 @@
+#include "hash.h"
+#include <cstring>
+
+static constexpr uint64_t prime1 = 11400714785074694791ULL;
+static constexpr uint64_t prime2 = 14029467366897019727ULL;
+static constexpr uint64_t prime3 = 1609587929392839161ULL;
+static constexpr uint64_t prime4 = 9650029242287828579ULL;
+static constexpr uint64_t prime5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p) {
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; --i) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+	return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+static inline uint64_t xxRound(uint64_t acc, uint64_t input) {
+	acc += input * prime2;
+	acc = rotl(acc, 31);
+	return acc * prime1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+	acc ^= xxRound(0, val);
+	return acc * prime1 + prime4;
+}
+
+ContentHasher::ContentHasher(uint64_t seed) : seed(seed) {
+	acc[0] = seed + prime1 + prime2;
+	acc[1] = seed + prime2;
+	acc[2] = seed;
+	acc[3] = seed - prime1;
+}
+
+void ContentHasher::update(const char* data, size_t size) {
+	auto p = reinterpret_cast<const unsigned char*>(data);
+	auto end = p + size;
+	totalLength += size;
+
+	if (buffered + size < sizeof(buffer)) {
+		std::memcpy(buffer + buffered, p, size);
+		buffered += size;
+		return;
+	}
+
+	if (buffered) {
+		size_t fill = sizeof(buffer) - buffered;
+		std::memcpy(buffer + buffered, p, fill);
+		p += fill;
+		for (int i = 0; i < 4; ++i) {
+			acc[i] = xxRound(acc[i], read64(buffer + 8 * i));
+		}
+		buffered = 0;
+	}
+
+	// The four lanes are independent, which keeps the CPU pipeline busy
+	for (; p + 32 <= end; p += 32) {
+		acc[0] = xxRound(acc[0], read64(p));
+		acc[1] = xxRound(acc[1], read64(p + 8));
+		acc[2] = xxRound(acc[2], read64(p + 16));
+		acc[3] = xxRound(acc[3], read64(p + 24));
+	}
+
+	buffered = end - p;
+	std::memcpy(buffer, p, buffered);
+}
+
+uint64_t ContentHasher::final() const {
+	uint64_t h;
+	if (totalLength >= 32) {
+		h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+		for (int i = 0; i < 4; ++i) {
+			h = mergeRound(h, acc[i]);
+		}
+	}
+	else {
+		h = seed + prime5;
+	}
+	h += totalLength;
+
+	const unsigned char* p = buffer;
+	const unsigned char* end = buffer + buffered;
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxRound(0, read64(p));
+		h = rotl(h, 27) * prime1 + prime4;
+	}
+	if (p + 4 <= end) {
+		h ^= uint64_t(read32(p)) * prime1;
+		h = rotl(h, 23) * prime2 + prime3;
+		p += 4;
+	}
+	for (; p < end; ++p) {
+		h ^= (*p) * prime5;
+		h = rotl(h, 11) * prime1;
+	}
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <llvm/ADT/StringRef.h>
+
+// Streaming implementation of the 64-bit xxHash (XXH64) algorithm.
+// Data can be fed in chunks of any size, the result is the same as hashing it at once.
+class ContentHasher {
+	uint64_t seed;
+	uint64_t acc[4];
+	unsigned char buffer[32];
+	size_t buffered = 0;
+	uint64_t totalLength = 0;
+
+public:
+	ContentHasher(uint64_t seed = 0);
+
+	void update(const char* data, size_t size);
+	void update(llvm::StringRef data) {
+		update(data.data(), data.size());
+	}
+
+	uint64_t final() const;
+};
+
+inline uint64_t hashContents(llvm::StringRef data) {
+	ContentHasher hasher;
+	hasher.update(data);
+	return hasher.final();
+}
@@ -1,6 +1,7 @@
 #include "libpacker.h"
 #include "fsutil.h"
 #include "exceptions.h"
+#include "phasestats.h"
 #include <llvm/Object/ArchiveWriter.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/FileSystem.h>
@@ -8,20 +9,32 @@
 using namespace llvm;
 
 void packIntoLib(const std::string& ifname, const std::string& ofname) {
-	StashCWD restoreCwdOnScopeExit;
-	sys::fs::set_current_path(removeFilename(ifname));
+	packIntoLib(std::vector<std::string>{ ifname }, ofname);
+}
 
-	auto baseifname = sys::path::filename(ifname);
-	auto memberOrErr = NewArchiveMember::getFile(baseifname, true);
-	if (auto err = memberOrErr.takeError()) {
-		throw llvm_error(std::move(err), "Could not open generated objectfile: ");
-	}
+void packIntoLib(const std::vector<std::string>& ifnames, const std::string& ofname) {
+	PhaseStats::Scope phase("pack_lib", ofname);
+	// only takes absolute archive path!
+	std::string absOfname = makeAbsolute(ofname);
+	std::vector<NewArchiveMember> members;
 
-	NewArchiveMember member[1] = { std::move(*memberOrErr) };
+	// The working directory is left alone, several libraries may be written concurrently
+	for (const auto& ifname : ifnames) {
+		auto memberOrErr = NewArchiveMember::getFile(ifname, true);
+		if (auto err = memberOrErr.takeError()) {
+			throw llvm_error(std::move(err), "Could not open generated objectfile: ");
+		}
+		// member names should not contain any directories
+		memberOrErr->MemberName = sys::path::filename(ifname);
+		members.push_back(std::move(*memberOrErr));
+	}
 
-	// only takes absolute archive path!
-	Error err = writeArchive(makeAbsolute(ofname), member, true, object::Archive::K_GNU, true, false);
+	Error err = writeArchive(absOfname, members, true, object::Archive::K_GNU, true, false);
 	if (err) {
 		throw llvm_error(std::move(err), "Could not write static library file: ");
 	}
+
+	uint64_t libSize = 0;
+	sys::fs::file_size(absOfname, libSize);
+	phase.setBytes(libSize);
 }
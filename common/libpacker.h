@@ -1,5 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 void packIntoLib(const std::string& ifname, const std::string& ofname);
+void packIntoLib(const std::vector<std::string>& ifnames, const std::string& ofname);
@@ -0,0 +1,95 @@
+#include "lz4.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// LZ4 block format constraints
+static constexpr size_t minMatch = 4;
+static constexpr size_t lastLiterals = 5; // the last 5 bytes are always literals
+static constexpr size_t matchFindLimit = 12; // the last match must start at least 12 bytes before the end
+static constexpr size_t maxOffset = 65535;
+
+static constexpr unsigned hashLog = 16;
+
+static inline uint32_t read32(const unsigned char* p) {
+	uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t hashSequence(uint32_t sequence) {
+	return (sequence * 2654435761U) >> (32 - hashLog);
+}
+
+static void writeLength(std::vector<char>& out, size_t length) {
+	for (; length >= 255; length -= 255) {
+		out.push_back(static_cast<char>(255));
+	}
+	out.push_back(static_cast<char>(length));
+}
+
+static void writeSequence(std::vector<char>& out, const unsigned char* literals, size_t literalCount,
+	size_t offset, size_t matchLength) {
+	size_t matchCode = matchLength ? matchLength - minMatch : 0;
+	unsigned char token = static_cast<unsigned char>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15));
+	out.push_back(static_cast<char>(token));
+
+	if (literalCount >= 15) {
+		writeLength(out, literalCount - 15);
+	}
+	out.insert(out.end(), literals, literals + literalCount);
+
+	if (!matchLength) { // last sequence has no match
+		return;
+	}
+	out.push_back(static_cast<char>(offset & 0xff));
+	out.push_back(static_cast<char>(offset >> 8));
+	if (matchCode >= 15) {
+		writeLength(out, matchCode - 15);
+	}
+}
+
+std::vector<char> compressLZ4(llvm::StringRef input) {
+	auto src = reinterpret_cast<const unsigned char*>(input.data());
+	size_t size = input.size();
+
+	std::vector<char> out;
+	out.reserve(size + size / 255 + 16);
+
+	size_t anchor = 0;
+	if (size > matchFindLimit) {
+		std::vector<size_t> table(size_t(1) << hashLog, SIZE_MAX);
+		size_t matchStartLimit = size - matchFindLimit;
+		size_t matchEndLimit = size - lastLiterals;
+
+		size_t pos = 0;
+		while (pos < matchStartLimit) {
+			uint32_t sequence = read32(src + pos);
+			size_t& entry = table[hashSequence(sequence)];
+			size_t candidate = entry;
+			entry = pos;
+
+			if (candidate == SIZE_MAX || pos - candidate > maxOffset || read32(src + candidate) != sequence) {
+				pos++;
+				continue;
+			}
+
+			size_t length = minMatch;
+			while (pos + length < matchEndLimit && src[candidate + length] == src[pos + length]) {
+				length++;
+			}
+
+			writeSequence(out, src + anchor, pos - anchor, pos - candidate, length);
+			pos += length;
+			anchor = pos;
+
+			// positions inside the match are skipped, remember at least one of them
+			if (pos < matchStartLimit) {
+				table[hashSequence(read32(src + pos - 2))] = pos - 2;
+			}
+		}
+	}
+
+	writeSequence(out, src + anchor, size - anchor, 0, 0);
+	return out;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <vector>
+#include <llvm/ADT/StringRef.h>
+
+// Compress data into a single LZ4 block.
+// The matching decoder is resman::detail::lz4_decompress in include/resman.h.
+std::vector<char> compressLZ4(llvm::StringRef input);
@@ -0,0 +1,78 @@
+#include "objcache.h"
+#include "fsutil.h"
+#include "exceptions.h"
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/Path.h>
+
+using namespace llvm;
+
+// Bump whenever the layout of generated objects changes
+static constexpr const char cacheFormatVersion[] = "4";
+
+ObjectCache::ObjectCache(const std::string& cacheDir) : dir(makeAbsolute(cacheDir)) {
+	if (auto errc = sys::fs::create_directories(dir)) {
+		throw llvm_ec_error(errc, "Cannot create cache directory: ");
+	}
+}
+
+std::string ObjectCache::computeKey(const ResourceEntry& res, StringRef contents, StringRef targetId) const {
+	MD5 hash;
+	// every field is terminated so that adjacent fields cannot be confused
+	for (StringRef field : { StringRef(cacheFormatVersion), targetId, StringRef(res.names.begin), StringRef(res.names.size),
+		StringRef(res.names.rawSize), StringRef(res.names.hash), StringRef(res.names.alignment) }) {
+		hash.update(field);
+		hash.update(StringRef("", 1));
+	}
+	hash.update(std::to_string(res.id));
+	hash.update(StringRef(res.compressed ? "c" : "u", 2));
+	hash.update(std::to_string(res.alignment));
+	hash.update(StringRef("", 1));
+	for (const auto& alias : res.aliases) {
+		hash.update(std::to_string(alias.id));
+		hash.update(StringRef("", 1));
+		for (StringRef field : { StringRef(alias.names.begin), StringRef(alias.names.size), StringRef(alias.names.rawSize),
+			StringRef(alias.names.hash), StringRef(alias.names.alignment) }) {
+			hash.update(field);
+			hash.update(StringRef("", 1));
+		}
+	}
+	hash.update(contents);
+
+	MD5::MD5Result result;
+	hash.final(result);
+
+	SmallString<32> key;
+	MD5::stringifyResult(result, key);
+	return key.str();
+}
+
+std::string ObjectCache::entryPath(StringRef key) const {
+	SmallString<260> path{dir};
+	sys::path::append(path, key + ".o");
+	return path.str();
+}
+
+bool ObjectCache::contains(StringRef key) const {
+	return sys::fs::exists(entryPath(key));
+}
+
+std::string ObjectCache::createTempFile(StringRef key, int& fd) const {
+	SmallString<260> model{dir};
+	sys::path::append(model, key + "-%%%%%%%.tmp");
+
+	SmallString<260> tempPath;
+	if (auto errc = sys::fs::createUniqueFile(model, fd, tempPath)) {
+		throw llvm_ec_error(errc, "Cannot create cache entry: ");
+	}
+	return tempPath.str();
+}
+
+void ObjectCache::commit(StringRef key, const std::string& tempPath) const {
+	// concurrent rescomp runs may produce the same entry, whichever rename comes last wins
+	if (auto errc = sys::fs::rename(tempPath, entryPath(key))) {
+		sys::fs::remove(tempPath);
+		throw llvm_ec_error(errc, "Cannot store cache entry: ");
+	}
+}
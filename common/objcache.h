@@ -0,0 +1,25 @@
+#pragma once
+
+#include "resource.h"
+#include <string>
+#include <llvm/ADT/StringRef.h>
+
+// On-disk cache of object files, each containing a single resource.
+// Entries are keyed by resource contents, resource ID, mangled symbol names
+// and the target configuration, so they never need to be invalidated.
+class ObjectCache {
+	std::string dir;
+
+public:
+	ObjectCache(const std::string& cacheDir);
+
+	std::string computeKey(const ResourceEntry& res, llvm::StringRef contents, llvm::StringRef targetId) const;
+
+	std::string entryPath(llvm::StringRef key) const;
+	bool contains(llvm::StringRef key) const;
+
+	// Creates a uniquely named temporary file in the cache directory
+	std::string createTempFile(llvm::StringRef key, int& fd) const;
+	// Atomically moves a finished object file into the cache
+	void commit(llvm::StringRef key, const std::string& tempPath) const;
+};
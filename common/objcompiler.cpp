@@ -1,7 +1,11 @@
 #include "objcompiler.h"
 #include "exceptions.h"
+#include "phasestats.h"
 
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Comdat.h>
+#include <llvm/IR/GlobalAlias.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/DiagnosticInfo.h>
@@ -10,40 +14,322 @@
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
 #include <llvm/ADT/Triple.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 #include <llvm/CodeGen/MachineModuleInfo.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Support/Host.h>
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
 using namespace llvm;
 
-static std::vector<Constant*> toConstantArray(const std::vector<char>& data, Type* elemType) {
-	std::vector<Constant*> res(data.size());
-	std::transform(data.cbegin(), data.cend(), res.begin(), [=](uint8_t val) {
-		return ConstantInt::get(elemType, val);
-	});
+GlobalVariable* addDataToModule(StringRef data,
+	const std::string& varBeginName, const std::string& varSizeName, uint64_t alignment,
+	Module& mod, LLVMContext& ctxt) {
+
+	auto dataSize = data.size();
+	if (alignment > Value::MaximumAlignment) {
+		throw llvm_string_error(std::to_string(alignment), "Alignment exceeds what LLVM supports: ");
+	}
+
+	IntegerType* int64 = IntegerType::get(ctxt, 64);
+
+	// Store the payload as one packed data constant. Building a ConstantInt per byte
+	// makes memory usage and codegen time explode for large resources.
+	ArrayRef<uint8_t> bytes(reinterpret_cast<const uint8_t*>(data.data()), dataSize);
+	Constant* initializer = ConstantDataArray::get(ctxt, bytes);
 
-	return res;
+	auto storage = new GlobalVariable(mod, initializer->getType(), true, GlobalValue::ExternalLinkage, initializer, varBeginName);
+	if (alignment > 1) {
+		storage->setAlignment(static_cast<unsigned>(alignment));
+	}
+	new GlobalVariable(mod, int64, true, GlobalValue::ExternalLinkage, ConstantInt::get(int64, dataSize), varSizeName);
+	return storage;
 }
 
-void addDataToModule(const std::vector<char>& data,
-	const std::string& varBeginName, const std::string& varSizeName,
-	Module& mod, LLVMContext& ctxt) {
 
-	auto dataSize = data.size();
+void addIntegerToModule(uint64_t value, const std::string& varName, Module& mod, LLVMContext& ctxt) {
+	IntegerType* int64 = IntegerType::get(ctxt, 64);
+	new GlobalVariable(mod, int64, true, GlobalValue::ExternalLinkage, ConstantInt::get(int64, value), varName);
+}
 
-	IntegerType* int32 = IntegerType::get(ctxt, 32);
-	IntegerType* byte = IntegerType::get(ctxt, 8);
-	ArrayType* byteArrayType = ArrayType::get(byte, dataSize);
 
-	Constant* initializer = ConstantArray::get(byteArrayType, toConstantArray(data, byte));
+void addAliasToModule(const std::string& aliasName, const std::string& varName, Module& mod) {
+	GlobalAlias::create(aliasName, mod.getNamedValue(varName));
+}
+
 
-	new GlobalVariable(mod, byteArrayType, true, GlobalValue::ExternalLinkage, initializer, varBeginName);
-	new GlobalVariable(mod, int32, true, GlobalValue::ExternalLinkage, ConstantInt::get(int32, dataSize), varSizeName);
+void addResourceComdat(const StorageNames& names, Module& mod) {
+	// Mach-O has no COMDATs, the linker dead-strips every symbol on its own there
+	if (Triple(sys::getDefaultTargetTriple()).isOSBinFormatMachO()) {
+		return;
+	}
+
+	Comdat* comdat = mod.getOrInsertComdat(names.begin);
+	for (const std::string* name : { &names.begin, &names.size, &names.rawSize, &names.hash, &names.alignment }) {
+		if (name->empty()) {
+			continue;
+		}
+		if (auto var = mod.getNamedGlobal(*name)) {
+			var->setComdat(comdat);
+		}
+	}
 }
 
 
+// Storage symbols are declared if the resource lives in another object file,
+// getOrInsertGlobal does not see those defined as aliases (pack files)
+static Constant* getStorageRef(const std::string& name, Type* type, Module& mod) {
+	Constant* storage = mod.getNamedValue(name);
+	if (!storage) {
+		storage = mod.getOrInsertGlobal(name, type);
+	}
+	return ConstantExpr::getBitCast(storage, type->getPointerTo());
+}
+
+static GlobalVariable* addPrivateArray(Constant* initializer, const Twine& name, Module& mod) {
+	return new GlobalVariable(mod, initializer->getType(), true, GlobalValue::PrivateLinkage, initializer, name);
+}
+
+void addIndexToModule(const ResourceIndex& index, ArrayRef<ResourceEntry> resources, Module& mod) {
+	LLVMContext& ctxt = mod.getContext();
+	IntegerType* int8 = IntegerType::get(ctxt, 8);
+	IntegerType* int32 = IntegerType::get(ctxt, 32);
+	IntegerType* int64 = IntegerType::get(ctxt, 64);
+	PointerType* int8Ptr = int8->getPointerTo();
+	PointerType* int32Ptr = int32->getPointerTo();
+	PointerType* int64Ptr = int64->getPointerTo();
+
+	// resman::detail::index_entry and resman::detail::resource_index
+	StructType* entryType = StructType::create(ctxt, { int8Ptr, int64Ptr, int64Ptr, int64Ptr, int8Ptr, int32, int32, int32 }, "resman.index_entry");
+	StructType* indexType = StructType::create(ctxt, {
+		int32, int32, int32, int32Ptr, int32Ptr, entryType->getPointerTo(),
+		int32, int32, int32Ptr, int32Ptr
+	}, "resman.resource_index");
+
+	std::vector<Constant*> entries;
+	for (const auto& entry : index.entries) {
+		const auto& res = resources[entry.resource];
+		auto pathVar = addPrivateArray(ConstantDataArray::getString(ctxt, entry.declaredPath, false), "resman.index.path", mod);
+		entries.push_back(ConstantStruct::get(entryType, {
+			getStorageRef(res.names.begin, int8, mod),
+			getStorageRef(res.names.size, int64, mod),
+			res.compressed ? getStorageRef(res.names.rawSize, int64, mod) : ConstantPointerNull::get(int64Ptr),
+			getStorageRef(res.names.hash, int64, mod),
+			ConstantExpr::getBitCast(pathVar, int8Ptr),
+			ConstantInt::get(int32, entry.id),
+			ConstantInt::get(int32, entry.declaredPath.size()),
+			ConstantInt::get(int32, res.alignment)
+		}));
+	}
+
+	auto addTable = [&](ArrayRef<uint32_t> values, const Twine& name) {
+		return ConstantExpr::getBitCast(addPrivateArray(ConstantDataArray::get(ctxt, values), name, mod), int32Ptr);
+	};
+	auto entriesVar = addPrivateArray(ConstantArray::get(ArrayType::get(entryType, entries.size()), entries), "resman.index.entries", mod);
+
+	Constant* indexInit = ConstantStruct::get(indexType, {
+		ConstantInt::get(int32, index.entries.size()),
+		ConstantInt::get(int32, index.byId.slots.size()),
+		ConstantInt::get(int32, index.byId.seeds.size()),
+		addTable(index.byId.seeds, "resman.index.seeds"),
+		addTable(index.byId.slots, "resman.index.slots"),
+		ConstantExpr::getBitCast(entriesVar, entryType->getPointerTo()),
+		ConstantInt::get(int32, index.byPath.slots.size()),
+		ConstantInt::get(int32, index.byPath.seeds.size()),
+		addTable(index.byPath.seeds, "resman.index.path_seeds"),
+		addTable(index.byPath.slots, "resman.index.path_slots")
+	});
+	new GlobalVariable(mod, indexType, true, GlobalValue::ExternalLinkage, indexInit, resourceIndexSymbol);
+}
+
+// Values of the POSIX constants used by the loader, the same on Linux and Darwin
+static constexpr int openReadOnly = 0; // O_RDONLY
+static constexpr int protRead = 1; // PROT_READ
+static constexpr int mapPrivateFixed = 0x02 | 0x10; // MAP_PRIVATE | MAP_FIXED
+
+// Runs before constructors with the default priority, which may already use resources
+static constexpr int packLoaderPriority = 101;
+
+// Room for the path of the executable when the pack path is relative to it (PATH_MAX on Linux)
+static constexpr uint32_t exePathCapacity = 4096;
+
+void addPackLoaderToModule(const PackLayout& layout, ArrayRef<ResourceEntry> resources,
+	const std::string& packPath, Module& mod) {
+	Triple theTriple(sys::getDefaultTargetTriple());
+	if (theTriple.isOSWindows()) {
+		throw llvm_string_error("Pack file output is only supported on POSIX targets.");
+	}
+
+	LLVMContext& ctxt = mod.getContext();
+	IntegerType* int8 = IntegerType::get(ctxt, 8);
+	IntegerType* int32 = IntegerType::get(ctxt, 32);
+	IntegerType* int64 = IntegerType::get(ctxt, 64);
+	IntegerType* intPtr = theTriple.isArch64Bit() ? int64 : int32; // size_t and off_t
+	PointerType* int8Ptr = int8->getPointerTo();
+
+	// Writable and zero-initialized, so the region only takes address space in .bss until it is mapped
+	ArrayType* regionType = ArrayType::get(int8, layout.capacity);
+	auto region = new GlobalVariable(mod, regionType, false, GlobalValue::InternalLinkage,
+		ConstantAggregateZero::get(regionType), "resman.pack");
+	uint64_t alignment = packRegionAlignment;
+	for (const auto& res : resources) {
+		alignment = std::max(alignment, res.alignment);
+	}
+	region->setAlignment(alignment);
+
+	auto regionAt = [&](uint64_t offset, Type* type) {
+		Constant* indices[] = { ConstantInt::get(int64, 0), ConstantInt::get(int64, offset) };
+		return ConstantExpr::getBitCast(ConstantExpr::getInBoundsGetElementPtr(regionType, region, indices), type->getPointerTo());
+	};
+	auto defineSymbol = [&](const std::string& name, Type* type, uint64_t offset) {
+		GlobalAlias::create(type, 0, GlobalValue::ExternalLinkage, name, regionAt(offset, type), &mod);
+	};
+
+	for (size_t i = 0; i < resources.size(); ++i) {
+		const auto& res = resources[i];
+		auto defineStorage = [&](const StorageNames& names) {
+			defineSymbol(names.begin, int8, layout.slots[i].offset);
+			defineSymbol(names.size, int64, packSizeOffset(i));
+			defineSymbol(names.hash, int64, packHashOffset(i));
+			if (res.compressed) {
+				defineSymbol(names.rawSize, int64, packRawSizeOffset(i));
+			}
+			// part of the layout, it does not have to be read from the pack
+			addIntegerToModule(res.alignment, names.alignment, mod, ctxt);
+		};
+
+		defineStorage(res.names);
+		for (const auto& alias : res.aliases) {
+			defineStorage(alias.names);
+		}
+	}
+
+	// Shared by the loaders of all packs in the program, resman::pack_error() reads it
+	auto errorVar = new GlobalVariable(mod, int8Ptr, false, GlobalValue::WeakAnyLinkage,
+		ConstantPointerNull::get(int8Ptr), packErrorSymbol);
+
+	auto openFunc = mod.getOrInsertFunction("open", FunctionType::get(int32, { int8Ptr, int32 }, true));
+	auto preadFunc = mod.getOrInsertFunction("pread", FunctionType::get(intPtr, { int32, int8Ptr, intPtr, intPtr }, false));
+	auto mmapFunc = mod.getOrInsertFunction("mmap", FunctionType::get(int8Ptr, { int8Ptr, intPtr, int32, int32, int32, intPtr }, false));
+	auto closeFunc = mod.getOrInsertFunction("close", FunctionType::get(int32, { int32 }, false));
+	auto writeFunc = mod.getOrInsertFunction("write", FunctionType::get(intPtr, { int32, int8Ptr, intPtr }, false));
+
+	auto loader = Function::Create(FunctionType::get(Type::getVoidTy(ctxt), false), GlobalValue::InternalLinkage,
+		"resman.pack.load", &mod);
+	auto entryBlock = BasicBlock::Create(ctxt, "entry", loader);
+	auto openBlock = BasicBlock::Create(ctxt, "open", loader);
+	auto checkBlock = BasicBlock::Create(ctxt, "check", loader);
+	auto mapBlock = BasicBlock::Create(ctxt, "map", loader);
+	auto doneBlock = BasicBlock::Create(ctxt, "done", loader);
+	auto cannotFindBlock = BasicBlock::Create(ctxt, "cannot_find", loader);
+	auto cannotOpenBlock = BasicBlock::Create(ctxt, "cannot_open", loader);
+	auto mismatchBlock = BasicBlock::Create(ctxt, "mismatch", loader);
+	auto cannotMapBlock = BasicBlock::Create(ctxt, "cannot_map", loader);
+
+	IRBuilder<> builder(entryBlock);
+	Value* path = nullptr;
+	if (sys::path::is_absolute(packPath)) {
+		path = builder.CreateGlobalStringPtr(packPath);
+		builder.CreateBr(openBlock);
+	}
+	else {
+		// relative to the directory of the executable: its path with the file name replaced
+		auto strrchrFunc = mod.getOrInsertFunction("strrchr", FunctionType::get(int8Ptr, { int8Ptr, int32 }, false));
+		auto memcpyFunc = mod.getOrInsertFunction("memcpy", FunctionType::get(int8Ptr, { int8Ptr, int8Ptr, intPtr }, false));
+		auto buffer = builder.CreateAlloca(ArrayType::get(int8, exePathCapacity + packPath.size() + 1));
+		path = builder.CreateConstInBoundsGEP2_32(buffer->getAllocatedType(), buffer, 0, 0);
+
+		Value* found;
+		if (theTriple.isOSDarwin()) {
+			auto getPathFunc = mod.getOrInsertFunction("_NSGetExecutablePath",
+				FunctionType::get(int32, { int8Ptr, int32->getPointerTo() }, false));
+			auto size = builder.CreateAlloca(int32);
+			builder.CreateStore(ConstantInt::get(int32, exePathCapacity), size);
+			found = builder.CreateICmpEQ(builder.CreateCall(getPathFunc, { path, size }), ConstantInt::get(int32, 0));
+		}
+		else {
+			auto readlinkFunc = mod.getOrInsertFunction("readlink", FunctionType::get(intPtr, { int8Ptr, int8Ptr, intPtr }, false));
+			auto length = builder.CreateCall(readlinkFunc, {
+				builder.CreateGlobalStringPtr("/proc/self/exe"), path, ConstantInt::get(intPtr, exePathCapacity - 1)
+			});
+			found = builder.CreateICmpSGE(length, ConstantInt::get(intPtr, 0));
+			// readlink does not terminate the path, an empty path on failure has no slash either
+			auto end = builder.CreateSelect(found, length, ConstantInt::get(intPtr, 0));
+			builder.CreateStore(ConstantInt::get(int8, 0), builder.CreateInBoundsGEP(int8, path, end));
+		}
+		auto slash = builder.CreateCall(strrchrFunc, { path, ConstantInt::get(int32, '/') });
+		found = builder.CreateAnd(found, builder.CreateICmpNE(slash, ConstantPointerNull::get(int8Ptr)));
+		auto appendBlock = BasicBlock::Create(ctxt, "append", loader, openBlock);
+		builder.CreateCondBr(found, appendBlock, cannotFindBlock);
+
+		builder.SetInsertPoint(appendBlock);
+		builder.CreateCall(memcpyFunc, {
+			builder.CreateInBoundsGEP(int8, slash, ConstantInt::get(int32, 1)),
+			builder.CreateGlobalStringPtr(packPath), ConstantInt::get(intPtr, packPath.size() + 1)
+		});
+		builder.CreateBr(openBlock);
+	}
+
+	builder.SetInsertPoint(openBlock);
+	auto regionPtr = regionAt(0, int8);
+	auto fd = builder.CreateCall(openFunc, { path, ConstantInt::get(int32, openReadOnly) });
+	builder.CreateCondBr(builder.CreateICmpSLT(fd, ConstantInt::get(int32, 0)), cannotOpenBlock, checkBlock);
+
+	// the program must be relinked whenever rescomp had to change the layout of the pack;
+	// the layout id is checked before mapping, so a mismatching pack leaves the region empty
+	builder.SetInsertPoint(checkBlock);
+	auto layoutId = builder.CreateAlloca(int64);
+	auto bytesRead = builder.CreateCall(preadFunc, {
+		fd, builder.CreateBitCast(layoutId, int8Ptr), ConstantInt::get(intPtr, sizeof(uint64_t)),
+		ConstantInt::get(intPtr, packLayoutIdOffset())
+	});
+	auto matches = builder.CreateAnd(
+		builder.CreateICmpEQ(bytesRead, ConstantInt::get(intPtr, sizeof(uint64_t))),
+		builder.CreateICmpEQ(builder.CreateLoad(layoutId), ConstantInt::get(int64, layout.id)));
+	auto closeAndMismatchBlock = BasicBlock::Create(ctxt, "close_mismatch", loader, mismatchBlock);
+	builder.CreateCondBr(matches, mapBlock, closeAndMismatchBlock);
+	builder.SetInsertPoint(closeAndMismatchBlock);
+	builder.CreateCall(closeFunc, { fd });
+	builder.CreateBr(mismatchBlock);
+
+	builder.SetInsertPoint(mapBlock);
+	auto mapped = builder.CreateCall(mmapFunc, {
+		regionPtr, ConstantInt::get(intPtr, layout.capacity), ConstantInt::get(int32, protRead),
+		ConstantInt::get(int32, mapPrivateFixed), fd, ConstantInt::get(intPtr, 0)
+	});
+	builder.CreateCall(closeFunc, { fd });
+	// a fixed mapping either lands on the region or fails and leaves it untouched
+	builder.CreateCondBr(builder.CreateICmpNE(mapped, regionPtr), cannotMapBlock, doneBlock);
+
+	builder.SetInsertPoint(doneBlock);
+	builder.CreateRetVoid();
+
+	// Resources of the pack keep reading as empty (the region is zero-initialized),
+	// the program finds out through resman::pack_error()
+	auto fail = [&](BasicBlock* block, const std::string& message) {
+		builder.SetInsertPoint(block);
+		auto messagePtr = builder.CreateGlobalStringPtr(message);
+		builder.CreateStore(messagePtr, errorVar);
+		std::string line = "resman: " + message + "\n";
+		builder.CreateCall(writeFunc, {
+			ConstantInt::get(int32, 2), builder.CreateGlobalStringPtr(line), ConstantInt::get(intPtr, line.size())
+		});
+		builder.CreateRetVoid();
+	};
+	fail(cannotFindBlock, "cannot find the executable to locate resource pack " + packPath);
+	fail(cannotOpenBlock, "cannot open resource pack " + packPath);
+	fail(mismatchBlock, "resource pack " + packPath + " does not match the program, it has to be relinked");
+	fail(cannotMapBlock, "cannot map resource pack " + packPath);
+
+	appendToGlobalCtors(mod, loader, packLoaderPriority);
+}
 
 static void InlineAsmDiagHandler(const SMDiagnostic &SMD, void *Context,
 	unsigned LocCookie) {
@@ -77,7 +363,7 @@ struct LLCDiagnosticHandler : public DiagnosticHandler {
 	}
 };
 
-static std::string getFeaturesStr() {
+static std::string computeFeaturesStr() {
 	SubtargetFeatures Features;
 
 	StringMap<bool> HostFeatures;
@@ -88,6 +374,28 @@ static std::string getFeaturesStr() {
 	return Features.getString();
 }
 
+// Host features are queried only once per process
+static const std::string& getFeaturesStr() {
+	static const std::string features = computeFeaturesStr();
+	return features;
+}
+
+std::string getResourceSectionName() {
+	Triple theTriple(sys::getDefaultTargetTriple());
+	switch (theTriple.getObjectFormat()) {
+	case Triple::MachO:
+		return std::string("__TEXT,__") + resourceSectionName;
+	case Triple::COFF:
+		return std::string(".") + resourceSectionName;
+	default:
+		return resourceSectionName;
+	}
+}
+
+std::string getTargetId(const std::string& mArch) {
+	return sys::getDefaultTargetTriple() + "/" + mArch + "/" + sys::getHostCPUName().str() + "/" + getFeaturesStr();
+}
+
 void generateObjectFile(Module& mod, const std::string& objFilename, const std::string& mArch) {
 	std::error_code errc;
 	llvm::ToolOutputFile objFile(objFilename, errc, llvm::sys::fs::F_None);
@@ -98,33 +406,66 @@ void generateObjectFile(Module& mod, const std::string& objFilename, const std::
 	objFile.keep();
 }
 
+// Targets and passes are registered only once, even when objects are generated from several threads
+static void initializeTargets() {
+	static std::once_flag initialized;
+	std::call_once(initialized, [] {
+		LLVMInitializeX86TargetInfo();
+		LLVMInitializeX86Target();
+		LLVMInitializeX86TargetMC();
+		LLVMInitializeX86AsmPrinter();
+		LLVMInitializeX86AsmParser();
+
+		PassRegistry *Registry = PassRegistry::getPassRegistry();
+		initializeCore(*Registry);
+		initializeCodeGen(*Registry);
+		initializeLoopStrengthReducePass(*Registry);
+		initializeLowerIntrinsicsPass(*Registry);
+		initializeEntryExitInstrumenterPass(*Registry);
+		initializePostInlineEntryExitInstrumenterPass(*Registry);
+		initializeUnreachableBlockElimLegacyPassPass(*Registry);
+		initializeConstantHoistingLegacyPassPass(*Registry);
+		initializeScalarOpts(*Registry);
+		initializeVectorization(*Registry);
+		initializeScalarizeMaskedMemIntrinPass(*Registry);
+		initializeExpandReductionsPass(*Registry);
+
+		initializeScavengerTestPass(*Registry);
+	});
+}
+
+// Creating a TargetMachine is expensive. It cannot be used by several threads at once,
+// so every thread keeps its own for all the objects it generates.
+static TargetMachine& getTargetMachine(const std::string& mArch) {
+	thread_local std::map<std::string, std::unique_ptr<TargetMachine>> targetMachines;
+
+	auto& target = targetMachines[mArch];
+	if (!target) {
+		Triple theTriple(sys::getDefaultTargetTriple());
+
+		std::string error;
+		const Target *theTarget = TargetRegistry::lookupTarget(mArch, theTriple, error);
+
+		if (!theTarget) {
+			throw llvm_string_error(error, "Compiler target not found: ");
+		}
+
+		std::string CPUStr = sys::getHostCPUName(), FeaturesStr = getFeaturesStr();
+
+		TargetOptions options;
+		target.reset(theTarget->createTargetMachine(
+			theTriple.getTriple(), CPUStr, FeaturesStr, options, llvm::None));
+	}
+	return *target;
+}
+
 void generateObjectFile(Module& mod, ToolOutputFile& objFile, const std::string& mArch) {
+	PhaseStats::Scope phase("codegen", mod.getModuleIdentifier());
 	auto fileType = TargetMachine::CGFT_ObjectFile;
 
-	LLVMInitializeX86TargetInfo();
-	LLVMInitializeX86Target();
-	LLVMInitializeX86TargetMC();
-	LLVMInitializeX86AsmPrinter();
-	LLVMInitializeX86AsmParser();
-
-	PassRegistry *Registry = PassRegistry::getPassRegistry();
-	initializeCore(*Registry);
-	initializeCodeGen(*Registry);
-	initializeLoopStrengthReducePass(*Registry);
-	initializeLowerIntrinsicsPass(*Registry);
-	initializeEntryExitInstrumenterPass(*Registry);
-	initializePostInlineEntryExitInstrumenterPass(*Registry);
-	initializeUnreachableBlockElimLegacyPassPass(*Registry);
-	initializeConstantHoistingLegacyPassPass(*Registry);
-	initializeScalarOpts(*Registry);
-	initializeVectorization(*Registry);
-	initializeScalarizeMaskedMemIntrinPass(*Registry);
-	initializeExpandReductionsPass(*Registry);
-
-	initializeScavengerTestPass(*Registry);
+	initializeTargets();
 
 	LLVMContext& ctxt = mod.getContext();
-	llvm_shutdown_obj Y;
 
 	ctxt.setDiscardValueNames(true);
 
@@ -133,20 +474,7 @@ void generateObjectFile(Module& mod, ToolOutputFile& objFile, const std::string&
 		llvm::make_unique<LLCDiagnosticHandler>(&hasError));
 	ctxt.setInlineAsmDiagnosticHandler(InlineAsmDiagHandler, &hasError);
 
-	Triple theTriple(sys::getDefaultTargetTriple());
-
-	std::string error;
-	const Target *theTarget = TargetRegistry::lookupTarget(mArch, theTriple, error);
-
-	if (!theTarget) {
-		throw llvm_string_error(error, "Compiler target not found: ");
-	}
-
-	std::string CPUStr = sys::getHostCPUName(), FeaturesStr = getFeaturesStr();
-
-	TargetOptions options;
-	std::unique_ptr<TargetMachine> target(theTarget->createTargetMachine(
-		theTriple.getTriple(), CPUStr, FeaturesStr, options, llvm::None));
+	TargetMachine* target = &getTargetMachine(mArch);
 
 	legacy::PassManager PM;
 	TargetLibraryInfoImpl TLII(Triple(mod.getTargetTriple()));
@@ -182,5 +510,6 @@ void generateObjectFile(Module& mod, ToolOutputFile& objFile, const std::string&
 		if (BOS) {
 			objFile.os() << Buffer;
 		}
+		phase.setBytes(objFile.os().tell());
 	}
 }
@@ -1,13 +1,43 @@
 #pragma once
 
+#include "resindex.h"
+#include "packfile.h"
 #include <string>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/ToolOutputFile.h>
 
-void addDataToModule(const std::vector<char>& data,
-	const std::string& varBeginName, const std::string& varSizeName,
+// Returns the storage_begin global
+llvm::GlobalVariable* addDataToModule(llvm::StringRef data,
+	const std::string& varBeginName, const std::string& varSizeName, uint64_t alignment,
 	llvm::Module& mod, llvm::LLVMContext& ctxt);
 
+void addIntegerToModule(uint64_t value, const std::string& varName, llvm::Module& mod, llvm::LLVMContext& ctxt);
+
+void addAliasToModule(const std::string& aliasName, const std::string& varName, llvm::Module& mod);
+
+// Puts the storage of a resource into a COMDAT group of its own, so that the linker
+// can drop it together with its size if the program never refers to it (-data-sections)
+void addResourceComdat(const StorageNames& names, llvm::Module& mod);
+
+// Defines resman_resource_index, storage of resources missing in the module is referenced as external
+void addIndexToModule(const ResourceIndex& index, llvm::ArrayRef<ResourceEntry> resources, llvm::Module& mod);
+
+// Reserves a region for the pack file and defines the storage symbols of resources at their offsets in it.
+// A constructor maps the pack from packPath over the region before other static initializers run,
+// a relative packPath is resolved against the directory of the executable. If the pack cannot be
+// mapped, resources read as empty and resman::pack_error() says why.
+void addPackLoaderToModule(const PackLayout& layout, llvm::ArrayRef<ResourceEntry> resources,
+	const std::string& packPath, llvm::Module& mod);
+
+// Name of the section for resource payloads in the target's object file format
+std::string getResourceSectionName();
+
+// Describes the target configuration used by generateObjectFile (triple, CPU and features)
+std::string getTargetId(const std::string& mArch);
+
 void generateObjectFile(llvm::Module& mod, llvm::ToolOutputFile& objFile, const std::string& mArch);
 void generateObjectFile(llvm::Module& mod, const std::string& objFilename, const std::string& mArch);
@@ -0,0 +1,453 @@
+#include "objwriter.h"
+#include "exceptions.h"
+#include "payload.h"
+
+#include <fstream>
+#include <llvm/ADT/Triple.h>
+#include <llvm/BinaryFormat/ELF.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MathExtras.h>
+
+using namespace llvm;
+
+static constexpr size_t streamChunkSize = 1 << 20;
+static constexpr uint64_t payloadAlignment = 16;
+
+static Triple getTargetTriple(const std::string& mArch) {
+	Triple theTriple(sys::getDefaultTargetTriple());
+	if (!mArch.empty()) {
+		auto arch = Triple::getArchTypeForLLVMName(mArch);
+		if (arch != Triple::UnknownArch) {
+			theTriple.setArch(arch);
+		}
+	}
+	return theTriple;
+}
+
+// Only 64-bit little-endian ELF targets are supported for now.
+// Everything else goes through the LLVM code generator.
+static uint16_t getElfMachine(const Triple& triple) {
+	if (!triple.isOSBinFormatELF() || triple.getEnvironment() == Triple::GNUX32) {
+		return ELF::EM_NONE;
+	}
+	switch (triple.getArch()) {
+	case Triple::x86_64:
+		return ELF::EM_X86_64;
+	case Triple::aarch64:
+		return ELF::EM_AARCH64;
+	default:
+		return ELF::EM_NONE;
+	}
+}
+
+bool canWriteObjectFileDirect(const std::string& mArch) {
+	return getElfMachine(getTargetTriple(mArch)) != ELF::EM_NONE;
+}
+
+namespace {
+	class StringTable {
+		std::string data{'\0'};
+
+	public:
+		uint32_t add(StringRef str) {
+			uint32_t offset = data.size();
+			data.append(str.begin(), str.end());
+			data.push_back('\0');
+			return offset;
+		}
+
+		StringRef str() const {
+			return data;
+		}
+	};
+
+	class ElfWriter {
+		raw_ostream& os;
+		uint64_t offset = 0;
+
+	public:
+		ElfWriter(raw_ostream& os) : os(os) {}
+
+		template <typename T>
+		void write(T value) {
+			char bytes[sizeof(T)];
+			for (size_t i = 0; i < sizeof(T); ++i) {
+				bytes[i] = static_cast<char>(static_cast<uint64_t>(value) >> (8 * i));
+			}
+			writeBytes(bytes, sizeof(T));
+		}
+
+		void writeBytes(const char* bytes, size_t count) {
+			os.write(bytes, count);
+			offset += count;
+		}
+
+		void padTo(uint64_t newOffset) {
+			static const char zeros[64] = {};
+			assert(newOffset >= offset);
+			while (offset < newOffset) {
+				auto count = static_cast<size_t>(std::min<uint64_t>(newOffset - offset, sizeof(zeros)));
+				writeBytes(zeros, count);
+			}
+		}
+
+		uint64_t tell() const {
+			return offset;
+		}
+
+		void writeHeader(uint16_t machine, uint8_t osabi, uint64_t shoff, uint16_t shnum, uint16_t shstrndx) {
+			const char ident[ELF::EI_NIDENT] = {
+				0x7f, 'E', 'L', 'F', ELF::ELFCLASS64, ELF::ELFDATA2LSB, ELF::EV_CURRENT, static_cast<char>(osabi)
+			};
+			writeBytes(ident, sizeof(ident));
+			write<uint16_t>(ELF::ET_REL);
+			write<uint16_t>(machine);
+			write<uint32_t>(ELF::EV_CURRENT);
+			write<uint64_t>(0); // e_entry
+			write<uint64_t>(0); // e_phoff
+			write<uint64_t>(shoff);
+			write<uint32_t>(0); // e_flags
+			write<uint16_t>(sizeof(ELF::Elf64_Ehdr));
+			write<uint16_t>(0); // e_phentsize
+			write<uint16_t>(0); // e_phnum
+			write<uint16_t>(sizeof(ELF::Elf64_Shdr));
+			write<uint16_t>(shnum);
+			write<uint16_t>(shstrndx);
+		}
+
+		void writeSectionHeader(uint32_t name, uint32_t type, uint64_t flags, uint64_t fileOffset, uint64_t size,
+			uint32_t link = 0, uint32_t info = 0, uint64_t align = 1, uint64_t entsize = 0) {
+			write<uint32_t>(name);
+			write<uint32_t>(type);
+			write<uint64_t>(flags);
+			write<uint64_t>(0); // sh_addr
+			write<uint64_t>(fileOffset);
+			write<uint64_t>(size);
+			write<uint32_t>(link);
+			write<uint32_t>(info);
+			write<uint64_t>(align);
+			write<uint64_t>(entsize);
+		}
+
+		void writeRelocation(uint64_t offset, uint32_t symbol, uint32_t type, int64_t addend) {
+			write<uint64_t>(offset);
+			write<uint64_t>((static_cast<uint64_t>(symbol) << 32) | type);
+			write<int64_t>(addend);
+		}
+
+		void writeSymbol(uint32_t name, uint8_t binding, uint8_t type, uint16_t shndx, uint64_t value, uint64_t size) {
+			write<uint32_t>(name);
+			write<uint8_t>((binding << 4) | (type & 0xf));
+			write<uint8_t>(ELF::STV_DEFAULT);
+			write<uint16_t>(shndx);
+			write<uint64_t>(value);
+			write<uint64_t>(size);
+		}
+
+		void streamFile(const std::string& path, uint64_t size) {
+			std::ifstream in(path, std::ios::binary);
+			if (!in) {
+				throw llvm_string_error("Could not open resource file \"" + path + "\".");
+			}
+
+			std::vector<char> chunk(streamChunkSize);
+			uint64_t remaining = size;
+			while (remaining) {
+				auto count = static_cast<size_t>(std::min<uint64_t>(remaining, chunk.size()));
+				in.read(chunk.data(), count);
+				if (static_cast<size_t>(in.gcount()) != count) {
+					throw llvm_string_error("Resource file \"" + path + "\" changed while being written.");
+				}
+				writeBytes(chunk.data(), count);
+				remaining -= count;
+			}
+		}
+	};
+
+	enum SectionIndex : uint16_t {
+		NullSection, RodataSection, ResmanSection, DataRelRoSection, RelaDataRelRoSection,
+		NoteGnuStackSection, SymtabSection, StrtabSection, ShstrtabSection, SectionCount
+	};
+
+	// Local section symbols used as relocation targets, they precede all global symbols
+	enum SymbolIndex : uint32_t {
+		NullSymbol, RodataSymbol, ResmanSymbol, DataRelRoSymbol, FirstGlobalSymbol
+	};
+
+	// Contents of .data.rel.ro, i.e. the runtime index, and its relocations
+	class RelocatedData {
+		std::string data;
+
+	public:
+		struct Relocation {
+			uint64_t offset;
+			uint32_t symbol;
+			int64_t addend;
+		};
+		std::vector<Relocation> relocations;
+
+		void add32(uint32_t value) {
+			for (int i = 0; i < 4; ++i) {
+				data.push_back(static_cast<char>(value >> (8 * i)));
+			}
+		}
+
+		void addPointer(uint32_t symbol, int64_t addend) {
+			relocations.push_back({ data.size(), symbol, addend });
+			data.append(8, '\0');
+		}
+
+		void addBytes(StringRef bytes) {
+			data.append(bytes.begin(), bytes.end());
+		}
+
+		void addNullPointer() {
+			data.append(8, '\0');
+		}
+
+		void align(size_t alignment) {
+			data.resize(alignTo(data.size(), alignment), '\0');
+		}
+
+		StringRef str() const {
+			return data;
+		}
+	};
+}
+
+static uint32_t getAbsoluteRelocationType(uint16_t machine) {
+	// the relocation types of both machines are separate unnamed enums
+	return machine == ELF::EM_AARCH64 ? static_cast<uint32_t>(ELF::R_AARCH64_ABS64) : static_cast<uint32_t>(ELF::R_X86_64_64);
+}
+
+// Same layout as resman::detail::resource_index followed by the entries, hash tables and paths (LP64)
+static void buildIndexData(const ResourceIndex& index, ArrayRef<uint64_t> payloadOffsets,
+	ArrayRef<uint64_t> sizeOffsets, ArrayRef<uint64_t> rawSizeOffsets, ArrayRef<uint64_t> hashOffsets,
+	ArrayRef<ResourceEntry> resources, RelocatedData& out) {
+
+	const uint64_t headerSize = 64, entrySize = 56;
+	const uint64_t entriesOffset = headerSize;
+	const uint64_t seedsOffset = entriesOffset + index.entries.size() * entrySize;
+	const uint64_t slotsOffset = seedsOffset + index.byId.seeds.size() * sizeof(uint32_t);
+	const uint64_t pathSeedsOffset = slotsOffset + index.byId.slots.size() * sizeof(uint32_t);
+	const uint64_t pathSlotsOffset = pathSeedsOffset + index.byPath.seeds.size() * sizeof(uint32_t);
+	const uint64_t pathsOffset = pathSlotsOffset + index.byPath.slots.size() * sizeof(uint32_t);
+
+	out.add32(index.entries.size());
+	out.add32(index.byId.slots.size());
+	out.add32(index.byId.seeds.size());
+	out.align(8);
+	out.addPointer(DataRelRoSymbol, seedsOffset);
+	out.addPointer(DataRelRoSymbol, slotsOffset);
+	out.addPointer(DataRelRoSymbol, entriesOffset);
+	out.add32(index.byPath.slots.size());
+	out.add32(index.byPath.seeds.size());
+	out.addPointer(DataRelRoSymbol, pathSeedsOffset);
+	out.addPointer(DataRelRoSymbol, pathSlotsOffset);
+
+	uint64_t pathOffset = pathsOffset;
+	for (const auto& entry : index.entries) {
+		out.addPointer(ResmanSymbol, payloadOffsets[entry.resource]);
+		out.addPointer(RodataSymbol, sizeOffsets[entry.resource]);
+		if (resources[entry.resource].compressed) {
+			out.addPointer(RodataSymbol, rawSizeOffsets[entry.resource]);
+		}
+		else {
+			out.addNullPointer();
+		}
+		out.addPointer(RodataSymbol, hashOffsets[entry.resource]);
+		out.addPointer(DataRelRoSymbol, pathOffset);
+		out.add32(entry.id);
+		out.add32(entry.declaredPath.size());
+		out.add32(resources[entry.resource].alignment);
+		out.align(8);
+		pathOffset += entry.declaredPath.size();
+	}
+
+	for (const auto* table : { &index.byId.seeds, &index.byId.slots, &index.byPath.seeds, &index.byPath.slots }) {
+		for (auto value : *table) {
+			out.add32(value);
+		}
+	}
+	for (const auto& entry : index.entries) {
+		out.addBytes(entry.declaredPath);
+	}
+	out.align(8);
+}
+
+void writeObjectFileDirect(ArrayRef<ResourceEntry> resources, raw_ostream& os, const std::string& mArch,
+	const ResourceIndex* index, bool pageAlignSection) {
+	Triple theTriple = getTargetTriple(mArch);
+	uint16_t machine = getElfMachine(theTriple);
+	if (machine == ELF::EM_NONE) {
+		throw llvm_string_error(theTriple.str(), "Direct object writer does not support target: ");
+	}
+
+	struct Symbol {
+		uint32_t name;
+		uint16_t section;
+		uint64_t value;
+		uint64_t size;
+	};
+
+	StringTable strtab, shstrtab;
+	std::vector<Symbol> symbols;
+
+	// Section layout must be known up front because the payloads are streamed.
+	// .rodata holds the table of sizes, hashes and alignments, the resman section holds aligned resource payloads.
+	const uint64_t rodataOffset = sizeof(ELF::Elf64_Ehdr);
+	uint64_t resmanAlignment = pageAlignSection ? resourceSectionAlignment : payloadAlignment;
+	for (const auto& res : resources) {
+		resmanAlignment = std::max(resmanAlignment, res.alignment);
+	}
+
+	std::vector<uint64_t> sizeTable;
+	std::vector<uint64_t> payloadSizes;
+	std::vector<uint64_t> payloadOffsets; // relative to the section start
+	// compressed payloads have to be kept in memory, the others are streamed from their files
+	std::vector<std::unique_ptr<MemoryBuffer>> payloadBuffers;
+
+	for (const auto& res : resources) {
+		uint64_t fileSize;
+		if (auto errc = sys::fs::file_size(res.path, fileSize)) {
+			throw llvm_ec_error(errc, ("Could not read resource file \"" + res.path + "\": ").c_str());
+		}
+
+		std::unique_ptr<MemoryBuffer> buffer;
+		uint64_t payloadSize = fileSize;
+		if (res.compressed) {
+			buffer = loadPayload(res);
+			payloadSize = buffer->getBufferSize();
+		}
+		payloadSizes.push_back(payloadSize);
+		payloadBuffers.push_back(std::move(buffer));
+
+		sizeTable.push_back(payloadSize);
+		if (res.compressed) {
+			sizeTable.push_back(fileSize);
+		}
+		sizeTable.push_back(res.hash);
+		sizeTable.push_back(res.alignment);
+	}
+
+	const uint64_t rodataSize = sizeTable.size() * sizeof(uint64_t);
+	uint64_t resmanSize = 0;
+	for (size_t i = 0; i < resources.size(); ++i) {
+		resmanSize = alignTo(resmanSize, std::max(payloadAlignment, resources[i].alignment));
+		payloadOffsets.push_back(resmanSize);
+		resmanSize += payloadSizes[i];
+	}
+
+	std::vector<uint64_t> sizeOffsets, rawSizeOffsets, hashOffsets;
+	size_t sizeIndex = 0;
+	for (size_t i = 0; i < resources.size(); ++i) {
+		const auto& res = resources[i];
+		uint64_t sizeOffset = sizeIndex++ * sizeof(uint64_t);
+		uint64_t rawSizeOffset = res.compressed ? sizeIndex++ * sizeof(uint64_t) : 0;
+		uint64_t hashOffset = sizeIndex++ * sizeof(uint64_t);
+		uint64_t alignmentOffset = sizeIndex++ * sizeof(uint64_t);
+		sizeOffsets.push_back(sizeOffset);
+		rawSizeOffsets.push_back(rawSizeOffset);
+		hashOffsets.push_back(hashOffset);
+
+		// aliases simply point to the same data
+		auto addStorageSymbols = [&](const StorageNames& names) {
+			symbols.push_back({ strtab.add(names.begin), ResmanSection, payloadOffsets[i], payloadSizes[i] });
+			symbols.push_back({ strtab.add(names.size), RodataSection, sizeOffset, sizeof(uint64_t) });
+			if (res.compressed) {
+				symbols.push_back({ strtab.add(names.rawSize), RodataSection, rawSizeOffset, sizeof(uint64_t) });
+			}
+			symbols.push_back({ strtab.add(names.hash), RodataSection, hashOffset, sizeof(uint64_t) });
+			symbols.push_back({ strtab.add(names.alignment), RodataSection, alignmentOffset, sizeof(uint64_t) });
+		};
+
+		addStorageSymbols(res.names);
+		for (const auto& alias : res.aliases) {
+			addStorageSymbols(alias.names);
+		}
+	}
+
+	RelocatedData indexData;
+	if (index) {
+		buildIndexData(*index, payloadOffsets, sizeOffsets, rawSizeOffsets, hashOffsets, resources, indexData);
+		symbols.push_back({ strtab.add(resourceIndexSymbol), DataRelRoSection, 0, 64 });
+	}
+
+	uint32_t rodataName = shstrtab.add(".rodata");
+	uint32_t resmanName = shstrtab.add(resourceSectionName);
+	uint32_t dataRelRoName = shstrtab.add(".data.rel.ro");
+	uint32_t relaName = shstrtab.add(".rela.data.rel.ro");
+	uint32_t noteName = shstrtab.add(".note.GNU-stack");
+	uint32_t symtabName = shstrtab.add(".symtab");
+	uint32_t strtabName = shstrtab.add(".strtab");
+	uint32_t shstrtabName = shstrtab.add(".shstrtab");
+
+	const uint64_t resmanOffset = alignTo(rodataOffset + rodataSize, resmanAlignment);
+	const uint64_t dataRelRoOffset = alignTo(resmanOffset + resmanSize, 8);
+	const uint64_t dataRelRoSize = indexData.str().size();
+	const uint64_t relaOffset = dataRelRoOffset + dataRelRoSize;
+	const uint64_t relaSize = indexData.relocations.size() * sizeof(ELF::Elf64_Rela);
+	const uint64_t symtabOffset = relaOffset + relaSize;
+	const uint64_t symbolCount = FirstGlobalSymbol + symbols.size();
+	const uint64_t symtabSize = symbolCount * sizeof(ELF::Elf64_Sym);
+	const uint64_t strtabOffset = symtabOffset + symtabSize;
+	const uint64_t shstrtabOffset = strtabOffset + strtab.str().size();
+	const uint64_t shdrOffset = alignTo(shstrtabOffset + shstrtab.str().size(), 8);
+
+	uint8_t osabi = theTriple.isOSFreeBSD() ? ELF::ELFOSABI_FREEBSD : ELF::ELFOSABI_NONE;
+
+	ElfWriter w(os);
+	w.writeHeader(machine, osabi, shdrOffset, SectionCount, ShstrtabSection);
+
+	// .rodata
+	for (auto size : sizeTable) {
+		w.write<uint64_t>(size);
+	}
+
+	// resman
+	for (size_t i = 0; i < resources.size(); ++i) {
+		w.padTo(resmanOffset + payloadOffsets[i]);
+		if (payloadBuffers[i]) {
+			w.writeBytes(payloadBuffers[i]->getBufferStart(), payloadBuffers[i]->getBufferSize());
+			payloadBuffers[i].reset();
+		}
+		else {
+			w.streamFile(resources[i].path, payloadSizes[i]);
+		}
+	}
+
+	// .data.rel.ro, .rela.data.rel.ro
+	w.padTo(dataRelRoOffset);
+	w.writeBytes(indexData.str().data(), dataRelRoSize);
+	for (const auto& rel : indexData.relocations) {
+		w.writeRelocation(rel.offset, rel.symbol, getAbsoluteRelocationType(machine), rel.addend);
+	}
+
+	// .symtab
+	w.writeSymbol(0, 0, 0, 0, 0, 0);
+	w.writeSymbol(0, ELF::STB_LOCAL, ELF::STT_SECTION, RodataSection, 0, 0);
+	w.writeSymbol(0, ELF::STB_LOCAL, ELF::STT_SECTION, ResmanSection, 0, 0);
+	w.writeSymbol(0, ELF::STB_LOCAL, ELF::STT_SECTION, DataRelRoSection, 0, 0);
+	for (const auto& sym : symbols) {
+		w.writeSymbol(sym.name, ELF::STB_GLOBAL, ELF::STT_OBJECT, sym.section, sym.value, sym.size);
+	}
+
+	// .strtab, .shstrtab
+	w.writeBytes(strtab.str().data(), strtab.str().size());
+	w.writeBytes(shstrtab.str().data(), shstrtab.str().size());
+
+	// section header table
+	w.padTo(shdrOffset);
+	w.writeSectionHeader(0, ELF::SHT_NULL, 0, 0, 0);
+	w.writeSectionHeader(rodataName, ELF::SHT_PROGBITS, ELF::SHF_ALLOC, rodataOffset, rodataSize, 0, 0, 8);
+	w.writeSectionHeader(resmanName, ELF::SHT_PROGBITS, ELF::SHF_ALLOC, resmanOffset, resmanSize, 0, 0, resmanAlignment);
+	w.writeSectionHeader(dataRelRoName, ELF::SHT_PROGBITS, ELF::SHF_ALLOC | ELF::SHF_WRITE, dataRelRoOffset, dataRelRoSize, 0, 0, 8);
+	w.writeSectionHeader(relaName, ELF::SHT_RELA, ELF::SHF_INFO_LINK, relaOffset, relaSize,
+		SymtabSection, DataRelRoSection, 8, sizeof(ELF::Elf64_Rela));
+	w.writeSectionHeader(noteName, ELF::SHT_PROGBITS, 0, relaOffset + relaSize, 0);
+	w.writeSectionHeader(symtabName, ELF::SHT_SYMTAB, 0, symtabOffset, symtabSize,
+		StrtabSection, FirstGlobalSymbol, 8, sizeof(ELF::Elf64_Sym));
+	w.writeSectionHeader(strtabName, ELF::SHT_STRTAB, 0, strtabOffset, strtab.str().size());
+	w.writeSectionHeader(shstrtabName, ELF::SHT_STRTAB, 0, shstrtabOffset, shstrtab.str().size());
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "resource.h"
+#include "resindex.h"
+#include <string>
+#include <vector>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+// Direct object file writer which bypasses LLVM code generation entirely.
+// Resource files are streamed into the output in fixed-size chunks,
+// so memory usage does not depend on the size of the resources.
+
+bool canWriteObjectFileDirect(const std::string& mArch);
+
+// Also defines resman_resource_index if an index is given.
+// Without pageAlignSection the section is only aligned as much as the resources require,
+// for objects with a single resource which would otherwise each be padded to a page when linked.
+void writeObjectFileDirect(llvm::ArrayRef<ResourceEntry> resources, llvm::raw_ostream& os, const std::string& mArch,
+	const ResourceIndex* index = nullptr, bool pageAlignSection = true);
@@ -0,0 +1,187 @@
+#include "packfile.h"
+#include "hash.h"
+#include "exceptions.h"
+#include "phasestats.h"
+#include <algorithm>
+#include <cstring>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/SwapByteOrder.h>
+
+using namespace llvm;
+
+static constexpr uint64_t payloadAlignment = 16;
+
+// Room left after each payload, so that edited resources usually fit in their old slot
+static uint64_t slotCapacity(uint64_t payloadSize) {
+	return alignTo(payloadSize + payloadSize / 4 + 256, payloadAlignment);
+}
+
+// Covers everything the generated symbols depend on: names, options and placement
+static uint64_t computeLayoutId(ArrayRef<ResourceEntry> resources, const PackLayout& layout) {
+	ContentHasher hasher;
+	auto addInt = [&](uint64_t value) {
+		hasher.update(reinterpret_cast<const char*>(&value), sizeof(value));
+	};
+	auto addNames = [&](const StorageNames& names) {
+		for (StringRef name : { StringRef(names.begin), StringRef(names.size), StringRef(names.rawSize), StringRef(names.hash),
+			StringRef(names.alignment) }) {
+			hasher.update(name);
+			hasher.update(StringRef("", 1));
+		}
+	};
+
+	addInt(packFormatVersion);
+	addInt(layout.capacity);
+	addInt(layout.headerSize);
+	addInt(resources.size());
+	for (size_t i = 0; i < resources.size(); ++i) {
+		const auto& res = resources[i];
+		addNames(res.names);
+		addInt(res.compressed);
+		addInt(res.alignment);
+		addInt(layout.slots[i].offset);
+		addInt(layout.slots[i].capacity);
+		addInt(res.aliases.size());
+		for (const auto& alias : res.aliases) {
+			addNames(alias.names);
+		}
+	}
+	return hasher.final();
+}
+
+// Converts between host and target byte order, the same call works in both directions
+static void swapForTarget(PackHeader& header, bool littleEndian) {
+	if (littleEndian != sys::IsLittleEndianHost) {
+		for (uint64_t* field : { &header.version, &header.layoutId, &header.capacity, &header.headerSize, &header.slotCount }) {
+			sys::swapByteOrder(*field);
+		}
+	}
+}
+
+static void swapForTarget(PackSlot& slot, bool littleEndian) {
+	if (littleEndian != sys::IsLittleEndianHost) {
+		for (uint64_t* field : { &slot.size, &slot.rawSize, &slot.offset, &slot.capacity, &slot.hash }) {
+			sys::swapByteOrder(*field);
+		}
+	}
+}
+
+bool readPackLayout(const std::string& path, bool littleEndian, PackLayout& layout) {
+	auto buffer = MemoryBuffer::getFile(path, -1, false);
+	if (!buffer) {
+		return false;
+	}
+
+	StringRef data = (*buffer)->getBuffer();
+	PackHeader header;
+	if (data.size() < sizeof(header)) {
+		return false;
+	}
+	std::memcpy(&header, data.data(), sizeof(header));
+	swapForTarget(header, littleEndian);
+	if (std::memcmp(header.magic, packMagic, sizeof(packMagic)) != 0 || header.version != packFormatVersion
+		|| header.slotCount > (data.size() - sizeof(header)) / sizeof(PackSlot)) {
+		return false;
+	}
+
+	layout.id = header.layoutId;
+	layout.capacity = header.capacity;
+	layout.headerSize = header.headerSize;
+	layout.slots.resize(header.slotCount);
+	if (header.slotCount) {
+		std::memcpy(layout.slots.data(), data.data() + sizeof(header), header.slotCount * sizeof(PackSlot));
+	}
+	for (auto& slot : layout.slots) {
+		swapForTarget(slot, littleEndian);
+	}
+	return true;
+}
+
+PackLayout layoutPack(ArrayRef<ResourceEntry> resources, ArrayRef<uint64_t> payloadSizes,
+	ArrayRef<uint64_t> rawSizes, const PackLayout* previous) {
+	if (previous && previous->slots.size() == resources.size()) {
+		PackLayout layout = *previous;
+		bool fits = true;
+		for (size_t i = 0; i < resources.size(); ++i) {
+			fits = fits && payloadSizes[i] <= layout.slots[i].capacity;
+			layout.slots[i].size = payloadSizes[i];
+			layout.slots[i].rawSize = rawSizes[i];
+			layout.slots[i].hash = resources[i].hash;
+		}
+		if (fits && computeLayoutId(resources, layout) == previous->id) {
+			return layout;
+		}
+	}
+
+	PackLayout layout;
+	layout.headerSize = alignTo(sizeof(PackHeader) + resources.size() * sizeof(PackSlot), resourceSectionAlignment);
+	uint64_t offset = layout.headerSize;
+	for (size_t i = 0; i < resources.size(); ++i) {
+		offset = alignTo(offset, std::max(payloadAlignment, resources[i].alignment));
+		layout.slots.push_back({ payloadSizes[i], rawSizes[i], offset, slotCapacity(payloadSizes[i]), resources[i].hash });
+		offset += layout.slots.back().capacity;
+	}
+	layout.capacity = alignTo(offset, packRegionAlignment);
+	layout.id = computeLayoutId(resources, layout);
+	return layout;
+}
+
+void writePackFile(const std::string& path, bool littleEndian, const PackLayout& layout, ArrayRef<StringRef> payloads) {
+	PhaseStats::Scope phase("write_pack", path);
+	int fd;
+	SmallString<260> tempPath;
+	if (auto errc = sys::fs::createUniqueFile(path + "-%%%%%%%.tmp", fd, tempPath)) {
+		throw llvm_ec_error(errc, "Cannot open output file: ");
+	}
+
+	{
+		raw_fd_ostream os(fd, true);
+		uint64_t offset = 0;
+		auto write = [&](const void* bytes, size_t count) {
+			os.write(static_cast<const char*>(bytes), count);
+			offset += count;
+		};
+		auto padTo = [&](uint64_t newOffset) {
+			static const char zeros[64] = {};
+			while (offset < newOffset) {
+				write(zeros, static_cast<size_t>(std::min<uint64_t>(newOffset - offset, sizeof(zeros))));
+			}
+		};
+
+		PackHeader header;
+		std::memcpy(header.magic, packMagic, sizeof(packMagic));
+		header.version = packFormatVersion;
+		header.layoutId = layout.id;
+		header.capacity = layout.capacity;
+		header.headerSize = layout.headerSize;
+		header.slotCount = layout.slots.size();
+		swapForTarget(header, littleEndian);
+		write(&header, sizeof(header));
+		for (PackSlot slot : layout.slots) {
+			swapForTarget(slot, littleEndian);
+			write(&slot, sizeof(slot));
+		}
+
+		for (size_t i = 0; i < payloads.size(); ++i) {
+			padTo(layout.slots[i].offset);
+			write(payloads[i].data(), payloads[i].size());
+		}
+
+		phase.setBytes(offset);
+		os.close();
+		if (os.has_error()) {
+			os.clear_error();
+			sys::fs::remove(tempPath);
+			throw llvm_string_error(path, "Cannot write pack file: ");
+		}
+	}
+
+	if (auto errc = sys::fs::rename(tempPath, path)) {
+		sys::fs::remove(tempPath);
+		throw llvm_ec_error(errc, "Cannot write pack file: ");
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "resource.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+// External resource pack (.rpak), mapped over a reserved region of the program at startup.
+// All integers are in the byte order of the target:
+//   PackHeader
+//   PackSlot per resource, its size and hash fields are the storage_size, storage_raw_size
+//   and storage_hash symbols
+//   payloads, starting at headerSize
+// Offsets are relative to the start of the file, which is also the start of the region.
+constexpr const char packMagic[8] = { 'R', 'E', 'S', 'M', 'P', 'A', 'K', '\0' };
+constexpr uint64_t packFormatVersion = 2;
+
+// const char* set by the loaders if a pack cannot be mapped, read by resman::pack_error()
+constexpr const char packErrorSymbol[] = "resman_pack_error";
+
+// The region is aligned for the largest page size of supported targets
+constexpr uint64_t packRegionAlignment = 65536;
+
+struct PackHeader {
+	char magic[8];
+	uint64_t version;
+	uint64_t layoutId; // checked by the program, identifies the symbol layout it was linked against
+	uint64_t capacity; // size of the reserved region
+	uint64_t headerSize; // offset of the payload area
+	uint64_t slotCount;
+};
+
+struct PackSlot {
+	uint64_t size; // storage_size
+	uint64_t rawSize; // storage_raw_size, 0 for uncompressed resources
+	uint64_t offset; // storage_begin
+	uint64_t capacity; // bytes reserved for the payload, it can grow up to this without relinking
+	uint64_t hash; // storage_hash
+};
+
+struct PackLayout {
+	uint64_t id = 0;
+	uint64_t capacity = 0;
+	uint64_t headerSize = 0;
+	std::vector<PackSlot> slots; // one per resource
+};
+
+inline uint64_t packSizeOffset(size_t slot) {
+	return sizeof(PackHeader) + slot * sizeof(PackSlot) + offsetof(PackSlot, size);
+}
+
+inline uint64_t packRawSizeOffset(size_t slot) {
+	return sizeof(PackHeader) + slot * sizeof(PackSlot) + offsetof(PackSlot, rawSize);
+}
+
+inline uint64_t packHashOffset(size_t slot) {
+	return sizeof(PackHeader) + slot * sizeof(PackSlot) + offsetof(PackSlot, hash);
+}
+
+inline uint64_t packLayoutIdOffset() {
+	return offsetof(PackHeader, layoutId);
+}
+
+// Reads the layout of an existing pack file, returns false if it is missing or invalid.
+// littleEndian is the byte order of the target.
+bool readPackLayout(const std::string& path, bool littleEndian, PackLayout& layout);
+
+// Places the payloads in the pack. The previous layout is kept if the resources are the same
+// and every payload still fits in its slot, so the program does not have to be relinked.
+// payloadSizes and rawSizes have one element per resource.
+PackLayout layoutPack(llvm::ArrayRef<ResourceEntry> resources, llvm::ArrayRef<uint64_t> payloadSizes,
+	llvm::ArrayRef<uint64_t> rawSizes, const PackLayout* previous);
+
+// Writes the pack into a temporary file and renames it over path,
+// so programs which already have the old pack mapped keep working
+void writePackFile(const std::string& path, bool littleEndian, const PackLayout& layout,
+	llvm::ArrayRef<llvm::StringRef> payloads);
@@ -0,0 +1,26 @@
+#include "payload.h"
+#include "fileio.h"
+#include "lz4.h"
+#include "phasestats.h"
+#include "exceptions.h"
+
+using namespace llvm;
+
+std::unique_ptr<MemoryBuffer> mapResourceFile(const ResourceEntry& res) {
+	auto expectedData = readFileIntoMemory(res.path);
+	if (auto err = expectedData.takeError()) {
+		throw llvm_error(std::move(err), ("Could not read resource file \"" + res.path + "\": ").c_str());
+	}
+	return std::move(*expectedData);
+}
+
+std::unique_ptr<MemoryBuffer> loadPayload(const ResourceEntry& res) {
+	auto data = mapResourceFile(res);
+	if (!res.compressed) {
+		return data;
+	}
+
+	PhaseStats::Scope phase("compress", res.path, data->getBufferSize());
+	auto compressed = compressLZ4(data->getBuffer());
+	return MemoryBuffer::getMemBufferCopy(StringRef(compressed.data(), compressed.size()), res.path);
+}
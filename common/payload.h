@@ -0,0 +1,11 @@
+#pragma once
+
+#include "resource.h"
+#include <memory>
+#include <llvm/Support/MemoryBuffer.h>
+
+// Map the resource file into memory, throws llvm_error on failure
+std::unique_ptr<llvm::MemoryBuffer> mapResourceFile(const ResourceEntry& res);
+
+// Bytes stored in Resource<id>::storage_begin, i.e. the file contents, compressed if requested
+std::unique_ptr<llvm::MemoryBuffer> loadPayload(const ResourceEntry& res);
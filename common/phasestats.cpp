@@ -0,0 +1,172 @@
+#include "phasestats.h"
+#include <llvm/Support/Format.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace llvm;
+
+static void writeJsonString(raw_ostream& os, StringRef str) {
+	os << '"';
+	for (char c : str) {
+		switch (c) {
+		case '"':
+			os << "\\\"";
+			break;
+		case '\\':
+			os << "\\\\";
+			break;
+		case '\n':
+			os << "\\n";
+			break;
+		case '\t':
+			os << "\\t";
+			break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				os << "\\u00";
+				os.write_hex(static_cast<unsigned char>(c) >> 4);
+				os.write_hex(static_cast<unsigned char>(c) & 0xf);
+			}
+			else {
+				os << c;
+			}
+		}
+	}
+	os << '"';
+}
+
+PhaseStats::Scope::Scope(const char* phase, StringRef subject, uint64_t bytes)
+	: phase(phase), bytes(bytes), startUs(0), active(PhaseStats::get().enabled()) {
+	if (active) {
+		this->subject = subject.str();
+		startUs = PhaseStats::get().now();
+	}
+}
+
+PhaseStats::Scope::~Scope() {
+	if (active) {
+		auto& stats = PhaseStats::get();
+		stats.record({ phase, std::move(subject), startUs, stats.now() - startUs, bytes, 0 });
+	}
+}
+
+PhaseStats& PhaseStats::get() {
+	static PhaseStats instance;
+	return instance;
+}
+
+void PhaseStats::enable() {
+	std::lock_guard<std::mutex> lock(mutex);
+	// the server starts a new recording for every request
+	events.clear();
+	threads.clear();
+	threads.insert({ std::this_thread::get_id(), 0 }); // the main thread
+	origin = std::chrono::steady_clock::now();
+	isEnabled = true;
+}
+
+void PhaseStats::disable() {
+	isEnabled = false;
+}
+
+uint64_t PhaseStats::now() const {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void PhaseStats::record(Event event) {
+	std::lock_guard<std::mutex> lock(mutex);
+	// small sequential thread numbers read better in the trace than native IDs
+	auto thread = threads.insert({ std::this_thread::get_id(), static_cast<unsigned>(threads.size()) });
+	event.thread = thread.first->second;
+	events.push_back(std::move(event));
+}
+
+void PhaseStats::writeJson(raw_ostream& os) const {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	struct Total {
+		uint64_t count = 0;
+		uint64_t durationUs = 0;
+		uint64_t bytes = 0;
+	};
+	std::map<std::string, Total> totals;
+	for (const auto& event : events) {
+		auto& total = totals[event.phase];
+		total.count++;
+		total.durationUs += event.durationUs;
+		total.bytes += event.bytes;
+	}
+
+	auto seconds = [](uint64_t us) {
+		return format("%.6f", us / 1e6);
+	};
+
+	os << "{\n  \"wall_seconds\": " << seconds(now()) << ",\n";
+	os << "  \"peak_rss_kb\": " << peakRSSKilobytes() << ",\n";
+	os << "  \"phases\": {";
+	bool first = true;
+	for (const auto& total : totals) {
+		os << (first ? "\n    " : ",\n    ");
+		writeJsonString(os, total.first);
+		os << ": { \"count\": " << total.second.count << ", \"seconds\": " << seconds(total.second.durationUs)
+			<< ", \"bytes\": " << total.second.bytes << " }";
+		first = false;
+	}
+	os << "\n  },\n  \"events\": [";
+	first = true;
+	for (const auto& event : events) {
+		os << (first ? "\n    " : ",\n    ");
+		os << "{ \"phase\": ";
+		writeJsonString(os, event.phase);
+		os << ", \"subject\": ";
+		writeJsonString(os, event.subject);
+		os << ", \"start_seconds\": " << seconds(event.startUs) << ", \"seconds\": " << seconds(event.durationUs)
+			<< ", \"bytes\": " << event.bytes << ", \"thread\": " << event.thread << " }";
+		first = false;
+	}
+	os << "\n  ]\n}\n";
+}
+
+void PhaseStats::writeChromeTrace(raw_ostream& os) const {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	for (const auto& event : events) {
+		os << (first ? "\n" : ",\n");
+		os << "{\"name\":";
+		writeJsonString(os, event.phase);
+		os << ",\"cat\":\"rescomp\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+			<< ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs << ",\"args\":{\"subject\":";
+		writeJsonString(os, event.subject);
+		os << ",\"bytes\":" << event.bytes << "}}";
+		first = false;
+	}
+	os << "\n]}\n";
+}
+
+uint64_t peakRSSKilobytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.PeakWorkingSetSize / 1024;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024; // bytes on Darwin
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
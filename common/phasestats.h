@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+// Timing of the phases of a rescomp run (parsing, reading, code generation, ...)
+// for -phase-stats and -phase-trace. Nothing is recorded unless it is enabled,
+// a Scope then only checks a flag.
+class PhaseStats {
+public:
+	struct Event {
+		std::string phase;
+		std::string subject; // input header, resource file or output the phase worked on
+		uint64_t startUs;
+		uint64_t durationUs;
+		uint64_t bytes;
+		unsigned thread;
+	};
+
+	// Records the time from construction to destruction as one event, scopes can be nested
+	class Scope {
+		const char* phase;
+		std::string subject;
+		uint64_t bytes;
+		uint64_t startUs;
+		bool active;
+
+	public:
+		Scope(const char* phase, llvm::StringRef subject = "", uint64_t bytes = 0);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		// for phases which only know how much data they processed at the end
+		void setBytes(uint64_t byteCount) {
+			bytes = byteCount;
+		}
+	};
+
+	static PhaseStats& get();
+
+	// Starts recording, events of a previous recording are discarded
+	void enable();
+	void disable();
+	bool enabled() const {
+		return isEnabled.load(std::memory_order_relaxed);
+	}
+
+	// Totals per phase and all events in the order they finished
+	void writeJson(llvm::raw_ostream& os) const;
+	// Chrome trace event format, for chrome://tracing or Perfetto
+	void writeChromeTrace(llvm::raw_ostream& os) const;
+
+private:
+	uint64_t now() const;
+	void record(Event event);
+
+	std::atomic<bool> isEnabled{false};
+	std::chrono::steady_clock::time_point origin;
+	mutable std::mutex mutex;
+	std::vector<Event> events;
+	std::map<std::thread::id, unsigned> threads;
+};
+
+// Peak resident set size of the process in kilobytes, 0 if the platform does not report it
+uint64_t peakRSSKilobytes();
@@ -0,0 +1,166 @@
+#include "resindex.h"
+#include "exceptions.h"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+using namespace llvm;
+
+constexpr uint32_t PerfectHash::emptySlot;
+
+// average number of keys per bucket, more means smaller seed table but longer construction
+static constexpr size_t keysPerBucket = 3;
+// give up on a table size after this many seeds for a single bucket and try a larger one
+static constexpr uint32_t maxSeed = 1 << 20;
+
+uint32_t indexHash(uint32_t key, uint32_t seed) {
+	uint32_t h = key ^ (seed * 0x9e3779b9u);
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+// 64-bit FNV-1a
+uint64_t pathHash(StringRef path) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (unsigned char c : path) {
+		h = (h ^ c) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+uint64_t pathSlotHash(uint64_t key, uint32_t seed) {
+	uint64_t h = key ^ (seed * 0x9e3779b97f4a7c15ull);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+// Try to place every bucket, largest first, returns false if some bucket does not fit
+template <typename HashFn>
+static bool placeBuckets(ArrayRef<uint64_t> keys, const std::vector<std::vector<uint32_t>>& buckets,
+	HashFn hash, PerfectHash& phf) {
+
+	std::vector<size_t> order(buckets.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return buckets[a].size() > buckets[b].size();
+	});
+
+	const uint64_t slotCount = phf.slots.size();
+	std::vector<uint32_t> candidates;
+
+	for (size_t b : order) {
+		const auto& bucket = buckets[b];
+		if (bucket.empty()) {
+			break;
+		}
+
+		bool placed = false;
+		for (uint32_t seed = 1; seed < maxSeed && !placed; ++seed) {
+			candidates.clear();
+			placed = true;
+			for (uint32_t key : bucket) {
+				uint32_t slot = hash(keys[key], seed) % slotCount;
+				if (phf.slots[slot] != PerfectHash::emptySlot
+					|| std::find(candidates.begin(), candidates.end(), slot) != candidates.end()) {
+					placed = false;
+					break;
+				}
+				candidates.push_back(slot);
+			}
+
+			if (placed) {
+				for (size_t i = 0; i < bucket.size(); ++i) {
+					phf.slots[candidates[i]] = bucket[i];
+				}
+				phf.seeds[b] = seed;
+			}
+		}
+
+		if (!placed) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Keys must be distinct. keyIndices maps the positions in keys to the values stored in the slots.
+template <typename HashFn>
+static PerfectHash buildPerfectHash(ArrayRef<uint64_t> keys, ArrayRef<uint32_t> keyIndices, HashFn hash) {
+	const size_t bucketCount = std::max<size_t>(1, (keys.size() + keysPerBucket - 1) / keysPerBucket);
+
+	std::vector<std::vector<uint32_t>> buckets(bucketCount);
+	for (size_t i = 0; i < keys.size(); ++i) {
+		buckets[hash(keys[i], 0) % bucketCount].push_back(i);
+	}
+
+	// A minimal table almost always works, spare slots are only added if it does not
+	PerfectHash phf;
+	for (size_t slotCount = std::max<size_t>(1, keys.size()); ; slotCount += slotCount / 16 + 1) {
+		phf.seeds.assign(bucketCount, 0);
+		phf.slots.assign(slotCount, PerfectHash::emptySlot);
+		if (placeBuckets(keys, buckets, hash, phf)) {
+			break;
+		}
+	}
+
+	for (auto& slot : phf.slots) {
+		if (slot != PerfectHash::emptySlot) {
+			slot = keyIndices[slot];
+		}
+	}
+	return phf;
+}
+
+ResourceIndex buildResourceIndex(ArrayRef<ResourceEntry> resources) {
+	ResourceIndex index;
+	for (size_t i = 0; i < resources.size(); ++i) {
+		index.entries.push_back({ static_cast<uint32_t>(resources[i].id), resources[i].declaredPath, i });
+		for (const auto& alias : resources[i].aliases) {
+			index.entries.push_back({ static_cast<uint32_t>(alias.id), alias.declaredPath, i });
+		}
+	}
+	std::sort(index.entries.begin(), index.entries.end(), [](const ResourceIndex::Entry& a, const ResourceIndex::Entry& b) {
+		return a.id < b.id;
+	});
+
+	std::vector<uint64_t> idKeys;
+	std::vector<uint32_t> idIndices;
+	for (size_t i = 0; i < index.entries.size(); ++i) {
+		idKeys.push_back(index.entries[i].id);
+		idIndices.push_back(i);
+	}
+	index.byId = buildPerfectHash(idKeys, idIndices, [](uint64_t key, uint32_t seed) {
+		return indexHash(static_cast<uint32_t>(key), seed);
+	});
+
+	// The same file may be declared under several IDs, the lowest one is found by path
+	std::vector<uint64_t> pathKeys;
+	std::vector<uint32_t> pathIndices;
+	std::unordered_map<uint64_t, size_t> seenPaths; // hash -> entry
+	for (size_t i = 0; i < index.entries.size(); ++i) {
+		const auto& path = index.entries[i].declaredPath;
+		uint64_t key = pathHash(path);
+		auto seen = seenPaths.insert({ key, i });
+		if (!seen.second) {
+			const auto& other = index.entries[seen.first->second].declaredPath;
+			if (other != path) {
+				throw llvm_string_error("Resource paths \"" + other + "\" and \"" + path + "\" have the same hash.");
+			}
+			continue;
+		}
+		pathKeys.push_back(key);
+		pathIndices.push_back(i);
+	}
+	index.byPath = buildPerfectHash(pathKeys, pathIndices, pathSlotHash);
+
+	return index;
+}
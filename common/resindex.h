@@ -0,0 +1,42 @@
+#pragma once
+
+#include "resource.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+// Symbol of the index, declared in resman.h
+constexpr const char resourceIndexSymbol[] = "resman_resource_index";
+
+// Minimal perfect hash (hash and displace) over a set of keys:
+// bucket = hash(key, 0) % seeds.size(), slot = hash(key, seeds[bucket]) % slots.size()
+struct PerfectHash {
+	static constexpr uint32_t emptySlot = ~0u;
+
+	std::vector<uint32_t> seeds; // one per bucket
+	std::vector<uint32_t> slots; // key index or emptySlot
+};
+
+// Runtime index of all resources, looked up by resman::find.
+// Entries are sorted by ID and located by ID or by their declared path.
+// The hash functions must be kept in sync with resman::detail::index_hash, path_hash and path_slot_hash.
+struct ResourceIndex {
+	struct Entry {
+		uint32_t id;
+		std::string declaredPath;
+		size_t resource; // index into the resources the index was built from
+	};
+
+	std::vector<Entry> entries;
+	PerfectHash byId; // keys are entry indices
+	PerfectHash byPath; // keys are entry indices, only the first of entries sharing a path is included
+};
+
+uint32_t indexHash(uint32_t key, uint32_t seed);
+uint64_t pathHash(llvm::StringRef path);
+uint64_t pathSlotHash(uint64_t key, uint32_t seed);
+
+// Aliases of deduplicated resources get their own entries pointing to the shared storage
+ResourceIndex buildResourceIndex(llvm::ArrayRef<ResourceEntry> resources);
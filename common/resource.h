@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Payloads of all resources are placed in a dedicated section, so they can be prefetched and released
+// without touching other constants. Objects with several resources page-align it; objects with a single
+// resource (mostly static library members with -cache-dir or -data-sections) do not, as the linker would pad
+// every one of them to a page.
+// On ELF the linker defines __start_resman/__stop_resman around it.
+constexpr const char resourceSectionName[] = "resman";
+constexpr uint64_t resourceSectionAlignment = 4096;
+
+// Mangled names of the storage members of Resource<id>
+struct StorageNames {
+	std::string begin; // storage_begin
+	std::string size; // storage_size
+	std::string rawSize; // storage_raw_size (compressed resources only)
+	std::string hash; // storage_hash
+	std::string alignment; // storage_alignment
+};
+
+// Another resource with identical contents, emitted as an alias of the first one's storage
+struct ResourceAlias {
+	uint64_t id;
+	std::string declaredPath;
+	StorageNames names;
+};
+
+// Resource declared in one of the input headers, resolved and ready to be emitted
+struct ResourceEntry {
+	uint64_t id;
+	std::string path; // absolute path of the resource file
+	std::string declaredPath; // path as written in the declaration, used for lookup at runtime
+	StorageNames names;
+	bool compressed = false; // declared as Resource<id, Compressed>
+	uint64_t alignment = 1; // of the storage, from the Align<K> option or -align
+	uint64_t hash = 0; // XXH64 of the uncompressed contents, filled in by deduplication before emitting
+	std::vector<std::string> transforms; // applied to the contents before they are embedded, see transform.h
+
+	// Other resources with identical contents
+	std::vector<ResourceAlias> aliases;
+};
@@ -0,0 +1,346 @@
+#include "server.h"
+#include "exceptions.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#ifndef _WIN32
+#include <csignal>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+#ifdef _WIN32
+
+void runServer(const std::string&, const ServerRequestHandler&) {
+	throw llvm_string_error("rescomp -server is not supported on Windows.");
+}
+
+bool forwardToServer(const std::string&, const std::vector<std::string>&, int&) {
+	return false;
+}
+
+#else
+
+// Request: magic, argument count, then each argument as length and bytes, the first one is
+// the working directory. The client's stdout and stderr travel with it as SCM_RIGHTS.
+// Response: the exit code.
+static constexpr uint32_t requestMagic = 0x52455331; // "RES1"
+static constexpr uint32_t maxArgumentSize = 1 << 20;
+
+static std::error_code lastError() {
+	return std::error_code(errno, std::generic_category());
+}
+
+static bool makeAddress(const std::string& socketPath, sockaddr_un& address) {
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		return false;
+	}
+	std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+	return true;
+}
+
+// Requests run with the server's rights, so both ends only talk to processes of the same user
+static bool peerIsCurrentUser(int fd) {
+#ifdef __linux__
+	ucred credentials;
+	socklen_t size = sizeof(credentials);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0) {
+		return false;
+	}
+	uid_t uid = credentials.uid;
+#else
+	uid_t uid;
+	gid_t gid;
+	if (getpeereid(fd, &uid, &gid) != 0) {
+		return false;
+	}
+#endif
+	return uid == geteuid();
+}
+
+// The socket directory is created if needed, it must belong to the current user and be closed to others
+static void checkSocketDirectory(const std::string& socketPath) {
+	SmallString<260> dir{socketPath};
+	sys::fs::make_absolute(dir);
+	sys::path::remove_filename(dir);
+	if (auto errc = sys::fs::create_directories(dir, true, sys::fs::owner_all)) {
+		throw llvm_ec_error(errc, "Cannot create socket directory: ");
+	}
+	sys::fs::file_status status;
+	if (sys::fs::status(dir, status) || status.getUser() != geteuid()
+		|| (status.permissions() & (sys::fs::group_all | sys::fs::others_all))) {
+		throw llvm_string_error(dir.str(), "Socket directory must be private to the current user (mode 0700): ");
+	}
+}
+
+static int connectTo(const std::string& socketPath) {
+	sockaddr_un address;
+	if (!makeAddress(socketPath, address)) {
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool readAll(int fd, void* data, size_t size) {
+	char* bytes = static_cast<char*>(data);
+	while (size) {
+		ssize_t count = read(fd, bytes, size);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			return false;
+		}
+		bytes += count;
+		size -= count;
+	}
+	return true;
+}
+
+static bool writeAll(int fd, const void* data, size_t size) {
+	const char* bytes = static_cast<const char*>(data);
+	while (size) {
+		ssize_t count = write(fd, bytes, size);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			return false;
+		}
+		bytes += count;
+		size -= count;
+	}
+	return true;
+}
+
+// Receives the magic and the client's stdout and stderr
+static bool receiveHeader(int fd, uint32_t& magic, int clientFds[2]) {
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	iovec iov = { &magic, sizeof(magic) };
+	msghdr msg;
+	std::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t count;
+	do {
+		count = recvmsg(fd, &msg, 0);
+	} while (count < 0 && errno == EINTR);
+
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+		|| cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+		return false;
+	}
+	std::memcpy(clientFds, CMSG_DATA(cmsg), 2 * sizeof(int));
+	if (count != sizeof(magic) || magic != requestMagic) {
+		close(clientFds[0]);
+		close(clientFds[1]);
+		return false;
+	}
+	return true;
+}
+
+static bool receiveArguments(int fd, std::vector<std::string>& args) {
+	uint32_t argCount;
+	if (!readAll(fd, &argCount, sizeof(argCount))) {
+		return false;
+	}
+	for (uint32_t i = 0; i < argCount; ++i) {
+		uint32_t size;
+		if (!readAll(fd, &size, sizeof(size)) || size > maxArgumentSize) {
+			return false;
+		}
+		std::string arg(size, '\0');
+		if (!readAll(fd, &arg[0], size)) {
+			return false;
+		}
+		args.push_back(std::move(arg));
+	}
+	return !args.empty();
+}
+
+// Runs the handler with the standard output and error of the client and in its working directory
+static int handleRequest(const std::vector<std::string>& request, const int clientFds[2],
+	const ServerRequestHandler& handler) {
+	SmallString<260> serverDir;
+	sys::fs::current_path(serverDir);
+
+	outs().flush();
+	errs().flush();
+	std::fflush(nullptr);
+	int savedOut = dup(STDOUT_FILENO);
+	int savedErr = dup(STDERR_FILENO);
+	dup2(clientFds[0], STDOUT_FILENO);
+	dup2(clientFds[1], STDERR_FILENO);
+
+	int exitCode;
+	if (auto errc = sys::fs::set_current_path(request.front())) {
+		errs() << "Error: cannot change to the working directory of the client: " << errc.message() << '\n';
+		exitCode = 1;
+	}
+	else {
+		exitCode = handler(std::vector<std::string>(request.begin() + 1, request.end()));
+	}
+
+	outs().flush();
+	errs().flush();
+	std::fflush(nullptr);
+	dup2(savedOut, STDOUT_FILENO);
+	dup2(savedErr, STDERR_FILENO);
+	close(savedOut);
+	close(savedErr);
+	sys::fs::set_current_path(serverDir);
+	return exitCode;
+}
+
+void runServer(const std::string& socketPath, const ServerRequestHandler& handler) {
+	sockaddr_un address;
+	if (!makeAddress(socketPath, address)) {
+		throw llvm_string_error(socketPath, "Socket path is too long: ");
+	}
+
+	checkSocketDirectory(socketPath);
+
+	// a socket nobody listens on is left over from a terminated server
+	int running = connectTo(socketPath);
+	if (running >= 0) {
+		close(running);
+		throw llvm_string_error(socketPath, "Another server is already listening on ");
+	}
+	unlink(socketPath.c_str());
+
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0) {
+		throw llvm_ec_error(lastError(), "Cannot create socket: ");
+	}
+	// connections are refused until listen(), so nobody gets in before the socket is private
+	if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+		|| chmod(socketPath.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(listenFd, 64) != 0) {
+		auto errc = lastError();
+		close(listenFd);
+		throw llvm_ec_error(errc, "Cannot listen on socket: ");
+	}
+
+	// a client which goes away must not take the server with it
+	std::signal(SIGPIPE, SIG_IGN);
+	outs() << "rescomp server listening on " << socketPath << '\n';
+	outs().flush();
+
+	while (true) {
+		int connFd = accept(listenFd, nullptr, nullptr);
+		if (connFd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			auto errc = lastError();
+			close(listenFd);
+			throw llvm_ec_error(errc, "Cannot accept connection: ");
+		}
+		if (!peerIsCurrentUser(connFd)) {
+			errs() << "warning: rejected a connection from another user\n";
+			close(connFd);
+			continue;
+		}
+
+		uint32_t magic;
+		int clientFds[2];
+		std::vector<std::string> request;
+		if (receiveHeader(connFd, magic, clientFds)) {
+			if (receiveArguments(connFd, request)) {
+				int32_t exitCode = handleRequest(request, clientFds, handler);
+				writeAll(connFd, &exitCode, sizeof(exitCode));
+			}
+			close(clientFds[0]);
+			close(clientFds[1]);
+		}
+		close(connFd);
+	}
+}
+
+bool forwardToServer(const std::string& socketPath, const std::vector<std::string>& args, int& exitCode) {
+	int fd = connectTo(socketPath);
+	if (fd < 0) {
+		return false;
+	}
+	// our stdout and stderr must not be handed to a server of someone else
+	if (!peerIsCurrentUser(fd)) {
+		errs() << "warning: the rescomp server on " << socketPath << " belongs to another user, it is not used\n";
+		close(fd);
+		return false;
+	}
+
+	SmallString<260> workingDir;
+	sys::fs::current_path(workingDir);
+
+	std::string payload;
+	auto append = [&](const void* data, size_t size) {
+		payload.append(static_cast<const char*>(data), size);
+	};
+	auto appendArgument = [&](StringRef arg) {
+		uint32_t size = static_cast<uint32_t>(arg.size());
+		append(&size, sizeof(size));
+		append(arg.data(), arg.size());
+	};
+	uint32_t argCount = static_cast<uint32_t>(args.size() + 1);
+	append(&argCount, sizeof(argCount));
+	appendArgument(workingDir);
+	for (const auto& arg : args) {
+		appendArgument(arg);
+	}
+
+	// the magic goes first, together with our stdout and stderr
+	uint32_t magic = requestMagic;
+	int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+	char control[CMSG_SPACE(sizeof(fds))];
+	std::memset(control, 0, sizeof(control));
+	iovec iov = { &magic, sizeof(magic) };
+	msghdr msg;
+	std::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	ssize_t sent;
+	do {
+		sent = sendmsg(fd, &msg, 0);
+	} while (sent < 0 && errno == EINTR);
+
+	int32_t result;
+	if (sent != sizeof(magic) || !writeAll(fd, payload.data(), payload.size()) || !readAll(fd, &result, sizeof(result))) {
+		errs() << "Error: the rescomp server on " << socketPath << " did not finish the request\n";
+		result = 1;
+	}
+	close(fd);
+	exitCode = result;
+	return true;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// `rescomp -server` keeps a process with warm state answering requests on a local (Unix) socket.
+// A request carries the arguments and working directory of a client invocation. The client's
+// standard output and error are passed along with it, so the server prints directly to them.
+// The socket is only accessible to the user running the server, in a directory private to
+// that user, and both ends reject peers running as another user.
+// Only supported on POSIX systems.
+
+// Handles the arguments of one request (without the program name), returns its exit code
+using ServerRequestHandler = std::function<int(const std::vector<std::string>& args)>;
+
+// Serves requests one at a time until the process is terminated.
+// Throws llvm_error if the socket cannot be set up, its directory is accessible to other users
+// or another server is already listening on it.
+void runServer(const std::string& socketPath, const ServerRequestHandler& handler);
+
+// Runs this invocation on the server listening on the socket.
+// Returns false if there is none or it runs as another user, the caller should then do the work itself.
+bool forwardToServer(const std::string& socketPath, const std::vector<std::string>& args, int& exitCode);
@@ -0,0 +1,89 @@
+#include "traitsheader.h"
+#include "payload.h"
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include <llvm/Support/Format.h>
+
+using namespace llvm;
+
+// Paths go into comments, which must not be ended early
+static std::string commentSafe(StringRef text) {
+	std::string result;
+	for (char c : text) {
+		result += (c == '\n' || c == '\r') ? ' ' : c;
+		if (result.size() >= 2 && result.compare(result.size() - 2, 2, "*/") == 0) {
+			result.insert(result.size() - 1, " ");
+		}
+	}
+	return result;
+}
+
+static size_t dataSize(StringRef data) {
+	return std::max<size_t>(data.size(), 1);
+}
+
+static void writeData(raw_ostream& os, StringRef data) {
+	os << "\t\tstatic constexpr unsigned char data[" << dataSize(data) << "] = {";
+	for (size_t i = 0; i < data.size(); ++i) {
+		os << (i % 16 == 0 ? "\n\t\t\t" : " ") << format_hex(static_cast<unsigned char>(data[i]), 4) << ',';
+	}
+	os << (data.empty() ? " 0 };\n" : "\n\t\t};\n");
+}
+
+void writeTraitsHeader(raw_ostream& os, ArrayRef<ResourceEntry> resources,
+	ArrayRef<std::pair<uint64_t, uint64_t>> sizesAndHashes, uint64_t inlineLimit) {
+	// sorted by ID, so that the header only changes when the resources do
+	std::vector<size_t> order(resources.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return resources[a].id < resources[b].id;
+	});
+
+	os << "// Generated by rescomp, do not edit\n"
+		"#pragma once\n"
+		"\n"
+		"#include \"resman.h\"\n"
+		"\n"
+		"namespace resman {\n";
+
+	for (size_t i : order) {
+		const auto& res = resources[i];
+		uint64_t size = sizesAndHashes[i].first;
+		uint64_t hash = sizesAndHashes[i].second;
+		bool inlined = inlineLimit && size <= inlineLimit;
+
+		os << "\t// \"" << commentSafe(res.declaredPath) << "\"\n"
+			<< "\ttemplate <typename T>\n"
+			<< "\tstruct resource_traits<" << res.id << ", T> {\n"
+			<< "\t\tstatic constexpr unsigned long long size = " << size << "ull;\n"
+			<< "\t\tstatic constexpr unsigned alignment = " << res.alignment << ";\n"
+			<< "\t\tstatic constexpr bool compressed = " << (res.compressed ? "true" : "false") << ";\n"
+			<< "\t\tstatic constexpr unsigned long long hash = " << format_hex(hash, 18) << "ull;\n"
+			<< "\t\tstatic constexpr bool has_data = " << (inlined ? "true" : "false") << ";\n";
+		size_t dataBytes = 0;
+		if (inlined) {
+			auto contents = mapResourceFile(res);
+			dataBytes = dataSize(contents->getBuffer());
+			writeData(os, contents->getBuffer());
+		}
+		os << "\t};\n";
+
+		// before C++17 static constexpr members are not inline, odr-uses (&data[0], binding
+		// to a const reference) need a definition
+		std::string scope = "\ttemplate <typename T> constexpr ";
+		std::string traits = "resource_traits<" + std::to_string(res.id) + ", T>::";
+		os << "#if __cplusplus < 201703L\n"
+			<< scope << "unsigned long long " << traits << "size;\n"
+			<< scope << "unsigned " << traits << "alignment;\n"
+			<< scope << "bool " << traits << "compressed;\n"
+			<< scope << "unsigned long long " << traits << "hash;\n"
+			<< scope << "bool " << traits << "has_data;\n";
+		if (inlined) {
+			os << scope << "unsigned char " << traits << "data[" << dataBytes << "];\n";
+		}
+		os << "#endif\n\n";
+	}
+
+	os << "}\n";
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "resource.h"
+#include <cstdint>
+#include <utility>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+// Writes a C++ header specializing resman::resource_traits<N> for every resource (-traits-header),
+// so that sizes and hashes can be used in constant expressions.
+// sizesAndHashes holds the size and XXH64 of the contents of each resource,
+// contents of resources up to inlineLimit bytes are included as data.
+void writeTraitsHeader(llvm::raw_ostream& os, llvm::ArrayRef<ResourceEntry> resources,
+	llvm::ArrayRef<std::pair<uint64_t, uint64_t>> sizesAndHashes, uint64_t inlineLimit);
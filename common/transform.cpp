@@ -0,0 +1,399 @@
+#include "transform.h"
+#include "exceptions.h"
+#include "phasestats.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <set>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FileUtilities.h>
+#include <llvm/Support/GlobPattern.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/StringSaver.h>
+
+using namespace llvm;
+
+// Bump whenever a built-in transform changes its output
+static constexpr const char transformFormatVersion[] = "1";
+
+static constexpr const char commandPrefix[] = "cmd:";
+
+static const char* const builtinTransforms[] = {
+	"null-terminate", "strip-comments", "strip-whitespace", "minify-json", "base64-decode"
+};
+
+std::vector<std::string> parseTransformList(StringRef list) {
+	std::vector<std::string> result;
+	for (list = list.ltrim(); !list.empty(); list = list.ltrim()) {
+		if (list.startswith(commandPrefix)) {
+			if (list.trim().size() == std::strlen(commandPrefix)) {
+				throw llvm_string_error("cmd: needs a command", "Invalid transform: ");
+			}
+			result.push_back(list.str());
+			break;
+		}
+
+		StringRef name;
+		std::tie(name, list) = list.split(',');
+		name = name.trim();
+		if (std::find(std::begin(builtinTransforms), std::end(builtinTransforms), name) == std::end(builtinTransforms)) {
+			throw llvm_string_error(name.str(), "Unknown transform: ");
+		}
+		result.push_back(name.str());
+	}
+
+	if (result.empty()) {
+		throw llvm_string_error("no transforms given", "Invalid transform: ");
+	}
+	return result;
+}
+
+bool runsCommand(ArrayRef<std::string> transforms) {
+	return std::any_of(transforms.begin(), transforms.end(), [](StringRef transform) {
+		return transform.startswith(commandPrefix);
+	});
+}
+
+TransformRule parseTransformRule(StringRef rule) {
+	StringRef glob, list;
+	std::tie(glob, list) = rule.split('=');
+	if (glob.size() == rule.size() || glob.empty()) {
+		throw llvm_string_error(rule.str(), "Invalid -transform, expected <glob>=<transforms>: ");
+	}
+	if (auto err = GlobPattern::create(glob).takeError()) {
+		throw llvm_error(std::move(err), "Invalid -transform pattern: ");
+	}
+	return { glob.str(), parseTransformList(list) };
+}
+
+std::vector<std::string> matchTransformRules(ArrayRef<TransformRule> rules, StringRef declaredPath) {
+	std::vector<std::string> result;
+	for (const auto& rule : rules) {
+		// the pattern was checked by parseTransformRule
+		if (cantFail(GlobPattern::create(rule.glob)).match(declaredPath)) {
+			result.insert(result.end(), rule.transforms.begin(), rule.transforms.end());
+		}
+	}
+	return result;
+}
+
+static llvm_string_error transformError(const std::string& msg, StringRef path) {
+	return llvm_string_error(msg, ("Cannot transform resource file \"" + path + "\": ").str().c_str());
+}
+
+static std::string stripComments(StringRef data) {
+	std::string out;
+	out.reserve(data.size());
+	size_t i = 0;
+	while (i < data.size()) {
+		char c = data[i];
+		if (c == '"' || c == '\'') {
+			// literals are copied as they are; one that is not closed on its line
+			// (an apostrophe in text) only protects the rest of that line
+			size_t end = i + 1;
+			while (end < data.size() && data[end] != c && data[end] != '\n') {
+				end += data[end] == '\\' ? 2 : 1;
+			}
+			end = std::min(end + 1, data.size());
+			out.append(data.data() + i, end - i);
+			i = end;
+		}
+		else if (data.substr(i, 2) == "//") {
+			// the line break is kept
+			i = std::min(data.find('\n', i), data.size());
+		}
+		else if (data.substr(i, 2) == "/*") {
+			size_t end = data.find("*/", i + 2);
+			end = end == StringRef::npos ? data.size() : end + 2;
+			// a space keeps the tokens around the comment apart, line breaks keep line numbers
+			size_t lines = data.slice(i, end).count('\n');
+			out.append(lines ? lines : 1, lines ? '\n' : ' ');
+			i = end;
+		}
+		else {
+			out += c;
+			++i;
+		}
+	}
+	return out;
+}
+
+static std::string stripWhitespace(StringRef data) {
+	std::string out;
+	out.reserve(data.size());
+	for (size_t pos = 0; pos < data.size();) {
+		size_t end = std::min(data.find('\n', pos), data.size());
+		StringRef line = data.slice(pos, end).trim(" \t\r\f\v");
+		if (!line.empty()) {
+			out += line;
+			if (end < data.size()) {
+				out += '\n';
+			}
+		}
+		pos = end + 1;
+	}
+	return out;
+}
+
+static std::string minifyJson(StringRef data) {
+	std::string out;
+	out.reserve(data.size());
+	bool inString = false;
+	for (size_t i = 0; i < data.size(); ++i) {
+		char c = data[i];
+		if (inString) {
+			out += c;
+			if (c == '\\' && i + 1 < data.size()) {
+				out += data[++i];
+			}
+			else if (c == '"') {
+				inString = false;
+			}
+		}
+		else if (c == '"') {
+			inString = true;
+			out += c;
+		}
+		else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+			out += c;
+		}
+	}
+	return out;
+}
+
+// Standard and URL-safe alphabets are both accepted
+static std::string decodeBase64(StringRef data, StringRef path) {
+	std::string out;
+	out.reserve(data.size() / 4 * 3);
+	uint32_t bits = 0;
+	unsigned bitCount = 0;
+	bool padding = false;
+	for (char c : data) {
+		unsigned value;
+		if (c >= 'A' && c <= 'Z') {
+			value = c - 'A';
+		}
+		else if (c >= 'a' && c <= 'z') {
+			value = c - 'a' + 26;
+		}
+		else if (c >= '0' && c <= '9') {
+			value = c - '0' + 52;
+		}
+		else if (c == '+' || c == '-') {
+			value = 62;
+		}
+		else if (c == '/' || c == '_') {
+			value = 63;
+		}
+		else if (c == '=') {
+			padding = true;
+			continue;
+		}
+		else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+			continue;
+		}
+		else {
+			throw transformError("invalid character in base64 data", path);
+		}
+
+		if (padding) {
+			throw transformError("base64 data continues after padding", path);
+		}
+		bits = (bits << 6) | value;
+		bitCount += 6;
+		if (bitCount >= 8) {
+			bitCount -= 8;
+			out += static_cast<char>((bits >> bitCount) & 0xff);
+		}
+	}
+	return out;
+}
+
+// The command runs in the shell with the contents on its stdin, its stdout becomes the new contents.
+// Its stderr goes to the terminal.
+static std::string runCommand(StringRef command, StringRef data, StringRef path) {
+#ifdef _WIN32
+	auto shell = sys::findProgramByName("cmd.exe");
+	const char* shellFlag = "/c";
+#else
+	auto shell = sys::findProgramByName("sh");
+	const char* shellFlag = "-c";
+#endif
+	if (!shell) {
+		throw transformError("cannot find the shell to run \"" + command.str() + "\"", path);
+	}
+
+	int inputFd;
+	SmallString<260> inputPath, outputPath;
+	if (auto errc = sys::fs::createTemporaryFile("rescomp-transform", "in", inputFd, inputPath)) {
+		throw llvm_ec_error(errc, "Cannot create temporary file: ");
+	}
+	FileRemover removeInput(inputPath);
+	{
+		raw_fd_ostream os(inputFd, true);
+		os << data;
+	}
+	if (auto errc = sys::fs::createTemporaryFile("rescomp-transform", "out", outputPath)) {
+		throw llvm_ec_error(errc, "Cannot create temporary file: ");
+	}
+	FileRemover removeOutput(outputPath);
+
+	std::string commandLine = command.str();
+	const char* args[] = { shell->c_str(), shellFlag, commandLine.c_str(), nullptr };
+	Optional<StringRef> redirects[] = { StringRef(inputPath), StringRef(outputPath), None };
+	std::string errMsg;
+	int result = sys::ExecuteAndWait(*shell, args, nullptr, redirects, 0, 0, &errMsg);
+	if (result != 0) {
+		throw transformError(result < 0 ? errMsg : "\"" + commandLine + "\" exited with code " + std::to_string(result), path);
+	}
+
+	auto output = MemoryBuffer::getFile(outputPath, -1, false);
+	if (!output) {
+		throw llvm_ec_error(output.getError(), "Cannot read the output of a transform command: ");
+	}
+	return (*output)->getBuffer().str();
+}
+
+std::string applyTransforms(ArrayRef<std::string> transforms, StringRef data, StringRef path) {
+	std::string contents = data.str();
+	for (StringRef transform : transforms) {
+		if (transform == "null-terminate") {
+			contents.push_back('\0');
+		}
+		else if (transform == "strip-comments") {
+			contents = stripComments(contents);
+		}
+		else if (transform == "strip-whitespace") {
+			contents = stripWhitespace(contents);
+		}
+		else if (transform == "minify-json") {
+			contents = minifyJson(contents);
+		}
+		else if (transform == "base64-decode") {
+			contents = decodeBase64(contents, path);
+		}
+		else if (transform.startswith(commandPrefix)) {
+			contents = runCommand(transform.drop_front(std::strlen(commandPrefix)), contents, path);
+		}
+		else {
+			throw llvm_string_error(transform.str(), "Unknown transform: ");
+		}
+	}
+	return contents;
+}
+
+std::vector<std::string> getTransformDependencies(ArrayRef<std::string> transforms) {
+	std::set<std::string> result;
+	for (StringRef transform : transforms) {
+		if (!transform.startswith(commandPrefix)) {
+			continue;
+		}
+
+		// shell syntax is close enough to find the words naming files
+		BumpPtrAllocator alloc;
+		StringSaver saver(alloc);
+		SmallVector<const char*, 8> words;
+		cl::TokenizeGNUCommandLine(transform.drop_front(std::strlen(commandPrefix)), saver, words);
+		for (size_t i = 0; i < words.size(); ++i) {
+			StringRef word = words[i];
+			if (sys::fs::is_regular_file(word)) {
+				SmallString<260> file{word};
+				sys::fs::make_absolute(file);
+				result.insert(file.str());
+			}
+			else if (i == 0 && !word.empty()) {
+				if (auto program = sys::findProgramByName(word)) {
+					result.insert(*program);
+				}
+			}
+		}
+	}
+	return std::vector<std::string>(result.begin(), result.end());
+}
+
+// Writes contents into an open file, removes the file if that fails
+static void writeContents(int fd, StringRef filePath, const std::string& contents) {
+	raw_fd_ostream os(fd, true);
+	os << contents;
+	os.close();
+	if (os.has_error()) {
+		os.clear_error();
+		sys::fs::remove(filePath);
+		throw llvm_string_error(filePath.str(), "Cannot write transformed contents: ");
+	}
+}
+
+TransformCache::TransformCache(const std::string& cacheDir) : dir(cacheDir) {}
+
+TransformCache::~TransformCache() {
+	for (const auto& file : tempFiles) {
+		sys::fs::remove(file);
+	}
+}
+
+std::string TransformCache::get(ArrayRef<std::string> transforms, StringRef input, StringRef path) const {
+	if (dir.empty() || runsCommand(transforms)) {
+		PhaseStats::Scope phase("transform", path, input.size());
+		std::string contents = applyTransforms(transforms, input, path);
+
+		int fd;
+		SmallString<260> tempPath;
+		if (auto errc = sys::fs::createTemporaryFile("rescomp-transform", "dat", fd, tempPath)) {
+			throw llvm_ec_error(errc, "Cannot create temporary file: ");
+		}
+		{
+			std::lock_guard<std::mutex> lock(tempLock);
+			tempFiles.push_back(tempPath.str());
+		}
+		writeContents(fd, tempPath, contents);
+		return tempPath.str();
+	}
+
+	if (auto errc = sys::fs::create_directories(dir)) {
+		throw llvm_ec_error(errc, "Cannot create cache directory: ");
+	}
+
+	MD5 hash;
+	// every field is terminated so that adjacent fields cannot be confused
+	hash.update(StringRef(transformFormatVersion, sizeof(transformFormatVersion)));
+	for (const auto& transform : transforms) {
+		hash.update(transform);
+		hash.update(StringRef("", 1));
+	}
+	hash.update(input);
+
+	MD5::MD5Result result;
+	hash.final(result);
+	SmallString<32> key;
+	MD5::stringifyResult(result, key);
+
+	SmallString<260> entryPath{dir};
+	sys::path::append(entryPath, key + ".dat");
+	if (sys::fs::exists(entryPath)) {
+		return entryPath.str();
+	}
+
+	PhaseStats::Scope phase("transform", path, input.size());
+	std::string contents = applyTransforms(transforms, input, path);
+
+	int fd;
+	SmallString<260> tempPath;
+	if (auto errc = sys::fs::createUniqueFile(entryPath + "-%%%%%%%.tmp", fd, tempPath)) {
+		throw llvm_ec_error(errc, "Cannot create cache entry: ");
+	}
+	writeContents(fd, tempPath, contents);
+	// concurrent rescomp runs may produce the same entry, whichever rename comes last wins
+	if (auto errc = sys::fs::rename(tempPath, entryPath)) {
+		sys::fs::remove(tempPath);
+		throw llvm_ec_error(errc, "Cannot store cache entry: ");
+	}
+	return entryPath.str();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+// Build-time transforms of resource contents, applied in order before the contents are
+// deduplicated, compressed and embedded:
+//   null-terminate    appends a '\0', so the data can be used as a C string
+//   strip-comments    removes // and /* */ comments outside of string and character literals
+//   strip-whitespace  removes leading and trailing whitespace of every line and empty lines
+//   minify-json       removes all whitespace outside of JSON strings
+//   base64-decode     decodes base64 text, line breaks and other whitespace are skipped
+//   cmd:<command>     pipes the contents through a shell command, from its stdin to its stdout
+
+// Splits a comma-separated list of transforms, cmd: takes the rest of the list as its command.
+// Throws if a transform is unknown.
+std::vector<std::string> parseTransformList(llvm::StringRef list);
+
+// True if one of the transforms is cmd:
+bool runsCommand(llvm::ArrayRef<std::string> transforms);
+
+// -transform <glob>=<transforms>, applies to resources whose declared path matches the glob
+struct TransformRule {
+	std::string glob;
+	std::vector<std::string> transforms;
+};
+
+TransformRule parseTransformRule(llvm::StringRef rule);
+
+// Transforms of all rules matching the declared path, in the order of the rules
+std::vector<std::string> matchTransformRules(llvm::ArrayRef<TransformRule> rules, llvm::StringRef declaredPath);
+
+// Throws if a transform fails, path is only used in messages
+std::string applyTransforms(llvm::ArrayRef<std::string> transforms, llvm::StringRef data, llvm::StringRef path);
+
+// Files named on the command lines of cmd: transforms which exist (scripts, data), and the
+// program each command starts if it can be found; the output depends on them as well
+std::vector<std::string> getTransformDependencies(llvm::ArrayRef<std::string> transforms);
+
+// Transformed contents, as plain files which take the place of the resource file after this stage.
+// With a cache directory they are kept there, keyed by the MD5 of the input and the transforms.
+// Without one, and always for cmd: transforms (the tool may change while its command line stays
+// the same), they are written to temporary files which are removed with this object.
+class TransformCache {
+	std::string dir;
+	mutable std::mutex tempLock;
+	mutable std::vector<std::string> tempFiles;
+
+public:
+	explicit TransformCache(const std::string& cacheDir = std::string());
+	TransformCache(const TransformCache&) = delete;
+	TransformCache& operator=(const TransformCache&) = delete;
+	~TransformCache();
+
+	// Path of the transformed contents of input, path is only used in messages
+	std::string get(llvm::ArrayRef<std::string> transforms, llvm::StringRef input, llvm::StringRef path) const;
+};
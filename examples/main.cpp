@@ -2,16 +2,26 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 
 using namespace resman;
 
-void printRes(ResourceHandle hnd) {
-	std::cout << hnd.id() << ": " << std::string(hnd.begin(), hnd.end()) << '\n';
+void printRes(const ResourceHandle& hnd) {
+	std::string_view text = hnd.view(); // no copy of the data
+	std::cout << hnd.id() << ": " << text << '\n';
 	std::cout << "Resource size: " << hnd.size() << '\n';
 	for (char c : hnd) {
 		std::cout << c << ' ';
 	}
 	std::cout << '\n';
+
+	// word by word, reading the embedded data in place
+	ResourceStream in(hnd);
+	std::string word;
+	while (in >> word) {
+		std::cout << '[' << word << "] ";
+	}
+	std::cout << '\n';
 }
 
 
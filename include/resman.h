@@ -1,47 +1,732 @@
 #pragma once
 
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define RESMAN_HAS_MADVISE 1
+#endif
+
 namespace resman {
 	// fwd
 	class ResourceHandle;
 
-	template <unsigned N>
+	// Resource options
+
+	// The resource is compressed by rescomp and decompressed on first access
+	struct Compressed {};
+
+	// The storage is aligned to K bytes (a power of two), so it can be viewed as an array of T with alignof(T) <= K
+	template <unsigned K>
+	struct Align {};
+
+	// Transforms applied by rescomp before the contents are embedded, in the order of the options.
+	// size() and the content hash describe the transformed contents. `rescomp -transform` applies
+	// them, and external commands, to all resources matching a glob.
+
+	// Appends a '\0', so that begin() can be used as a C string (size() includes it)
+	struct NullTerminate {};
+	// Removes // and /* */ comments outside of string and character literals (GLSL, HLSL, JS, ...)
+	struct StripComments {};
+	// Removes leading and trailing whitespace of every line and empty lines
+	struct StripWhitespace {};
+	// Removes all whitespace outside of JSON strings
+	struct MinifyJson {};
+	// Embeds the bytes encoded in base64 text
+	struct Base64Decode {};
+
+	// Properties of Resource<N> as constant expressions, specialized for every resource
+	// in the header written by `rescomp -traits-header`:
+	//   size        uncompressed size in bytes, as returned by ResourceHandle::size()
+	//   alignment   alignment of the data, as returned by ResourceHandle::alignment() (resources with
+	//               identical contents share storage aligned for the strictest of them)
+	//   compressed  declared with the Compressed option
+	//   hash        XXH64 (seed 0) of the uncompressed contents
+	//   has_data    data holds the contents (resources up to `-traits-inline` bytes)
+	// The header uses partial specializations on the second parameter, so that the out-of-class
+	// definitions C++11/14 need for odr-used members can be repeated in every translation unit.
+	template <unsigned N, typename = void>
+	struct resource_traits;
+
+	namespace detail {
+		template <typename Option, typename... Options>
+		struct has_option : std::false_type {};
+
+		template <typename Option, typename First, typename... Rest>
+		struct has_option<Option, First, Rest...>
+			: std::integral_constant<bool, std::is_same<Option, First>::value || has_option<Option, Rest...>::value> {};
+
+		// The largest K of all Align<K> options, 1 if there is none
+		template <typename... Options>
+		struct option_alignment : std::integral_constant<unsigned, 1> {};
+
+		template <typename First, typename... Rest>
+		struct option_alignment<First, Rest...> : option_alignment<Rest...> {};
+
+		template <unsigned K, typename... Rest>
+		struct option_alignment<Align<K>, Rest...>
+			: std::integral_constant<unsigned, (K > option_alignment<Rest...>::value ? K : option_alignment<Rest...>::value)> {};
+
+		// Decoder for the LZ4 block format written by rescomp
+		inline bool lz4_decompress(const char* src, std::size_t src_size, char* dst, std::size_t dst_size) {
+			const unsigned char* ip = reinterpret_cast<const unsigned char*>(src);
+			const unsigned char* const iend = ip + src_size;
+			unsigned char* op = reinterpret_cast<unsigned char*>(dst);
+			unsigned char* const ostart = op;
+			unsigned char* const oend = op + dst_size;
+
+			while (ip < iend) {
+				const unsigned token = *ip++;
+
+				std::size_t literals = token >> 4;
+				if (literals == 15) {
+					unsigned char b;
+					do {
+						if (ip == iend) return false;
+						b = *ip++;
+						literals += b;
+					} while (b == 255);
+				}
+				if (literals > std::size_t(iend - ip) || literals > std::size_t(oend - op)) return false;
+				std::memcpy(op, ip, literals);
+				ip += literals;
+				op += literals;
+
+				if (ip == iend) break; // the last sequence has no match
+
+				if (iend - ip < 2) return false;
+				const std::size_t offset = ip[0] | (ip[1] << 8);
+				ip += 2;
+				if (offset == 0 || offset > std::size_t(op - ostart)) return false;
+
+				std::size_t length = token & 15;
+				if (length == 15) {
+					unsigned char b;
+					do {
+						if (ip == iend) return false;
+						b = *ip++;
+						length += b;
+					} while (b == 255);
+				}
+				length += 4;
+				if (length > std::size_t(oend - op)) return false;
+
+				const unsigned char* match = op - offset;
+				if (offset >= length) {
+					std::memcpy(op, match, length);
+					op += length;
+				}
+				else { // overlapping match repeats the last `offset` bytes
+					while (length--) *op++ = *match++;
+				}
+			}
+
+			return op == oend;
+		}
+
+		// Decompressed copies of compressed resources, created on first access and kept until exit.
+		// Copies are aligned as requested by the handle. Handles of the same resource may disagree
+		// (Align<K> vs `rescomp -align`), a more aligned copy is made if needed.
+		inline const char* decompressed_storage(const char* src, std::size_t src_size, std::size_t raw_size, std::size_t alignment) {
+			struct aligned_buffer {
+				std::unique_ptr<char[]> memory;
+				char* data;
+			};
+			static std::mutex cache_lock;
+			static std::multimap<const char*, aligned_buffer> cache;
+
+			std::lock_guard<std::mutex> guard(cache_lock);
+			auto copies = cache.equal_range(src);
+			for (auto it = copies.first; it != copies.second; ++it) {
+				if (reinterpret_cast<std::uintptr_t>(it->second.data) % alignment == 0) {
+					return it->second.data;
+				}
+			}
+
+			aligned_buffer storage;
+			storage.memory.reset(new char[raw_size + alignment]);
+			std::uintptr_t address = reinterpret_cast<std::uintptr_t>(storage.memory.get());
+			storage.data = storage.memory.get() + (alignment - address % alignment) % alignment;
+			if (!lz4_decompress(src, src_size, storage.data, raw_size)) {
+				std::abort(); // embedded data is corrupted
+			}
+			return cache.insert(std::make_pair(src, std::move(storage)))->second.data;
+		}
+
+		// Pointer to the decompressed copy of one resource, so that only the first access of a
+		// handle goes through decompressed_storage() and its lock
+		template <typename R>
+		inline std::atomic<const char*>& decompressed_slot() {
+			static std::atomic<const char*> data(nullptr);
+			return data;
+		}
+
+		// Same for resources found through the index, looked up once when the handle is created
+		inline std::atomic<const char*>& decompressed_slot(const char* src) {
+			static std::mutex slots_lock;
+			static std::map<const char*, std::atomic<const char*>> slots;
+
+			std::lock_guard<std::mutex> guard(slots_lock);
+			return slots[src]; // value-initialized to nullptr
+		}
+
+		// Page-granular madvise. Prefetching rounds the range outwards, releasing rounds it inwards
+		// so that pages shared with neighbouring data stay untouched.
+		inline bool advise(const char* data, std::size_t size, bool prefetch) {
+#ifdef RESMAN_HAS_MADVISE
+			const std::uintptr_t page = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+			std::uintptr_t first = reinterpret_cast<std::uintptr_t>(data);
+			std::uintptr_t last = first + size;
+			if (prefetch) {
+				first -= first % page;
+				last += (page - last % page) % page;
+			}
+			else {
+				first += (page - first % page) % page;
+				last -= last % page;
+			}
+			if (first >= last) {
+				return true;
+			}
+			return madvise(reinterpret_cast<void*>(first), last - first, prefetch ? MADV_WILLNEED : MADV_DONTNEED) == 0;
+#else
+			(void)data; (void)size; (void)prefetch;
+			return false;
+#endif
+		}
+
+		// Layout of the runtime index emitted by `rescomp -index`
+		struct index_entry {
+			const char* storage;
+			const unsigned long long* stored_size;
+			const unsigned long long* raw_size; // null for uncompressed resources
+			const unsigned long long* hash;
+			const char* path; // as declared, not null-terminated
+			unsigned id;
+			unsigned path_size;
+			unsigned alignment;
+		};
+
+		struct resource_index {
+			unsigned entry_count;
+			unsigned slot_count;
+			unsigned bucket_count;
+			const unsigned* seeds; // hash seed of each bucket
+			const unsigned* slots; // index into entries, ~0u if the slot is empty
+			const index_entry* entries; // sorted by ID
+
+			// the same kind of table for lookup by path
+			unsigned path_slot_count;
+			unsigned path_bucket_count;
+			const unsigned* path_seeds;
+			const unsigned* path_slots;
+		};
+
+		// Must match the hash function used by rescomp to build the index
+		inline unsigned index_hash(unsigned key, unsigned seed) {
+			unsigned h = key ^ (seed * 0x9e3779b9u);
+			h ^= h >> 16;
+			h *= 0x85ebca6bu;
+			h ^= h >> 13;
+			h *= 0xc2b2ae35u;
+			h ^= h >> 16;
+			return h;
+		}
+
+		// 64-bit FNV-1a, usable in constant expressions
+#if __cplusplus >= 201402L
+		constexpr unsigned long long path_hash(const char* path, std::size_t size) {
+			unsigned long long h = 0xcbf29ce484222325ull;
+			for (std::size_t i = 0; i < size; ++i) {
+				h = (h ^ static_cast<unsigned char>(path[i])) * 0x100000001b3ull;
+			}
+			return h;
+		}
+#else
+		constexpr unsigned long long path_hash(const char* path, std::size_t size, unsigned long long h = 0xcbf29ce484222325ull) {
+			return size == 0 ? h : path_hash(path + 1, size - 1, (h ^ static_cast<unsigned char>(*path)) * 0x100000001b3ull);
+		}
+#endif
+
+		inline unsigned long long path_slot_hash(unsigned long long key, unsigned seed) {
+			unsigned long long h = key ^ (seed * 0x9e3779b97f4a7c15ull);
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ull;
+			h ^= h >> 33;
+			return h;
+		}
+	}
+
+	// Resource path as declared together with its hash, which is computed at compile time for constant paths:
+	// constexpr resman::PathKey key("shaders/blur.frag");
+	struct PathKey {
+		const char* path;
+		std::size_t size;
+		unsigned long long hash;
+
+		template <std::size_t S>
+		constexpr PathKey(const char (&path)[S])
+			: path(path), size(S - 1), hash(detail::path_hash(path, S - 1)) {}
+
+		constexpr PathKey(const char* path, std::size_t size)
+			: path(path), size(size), hash(detail::path_hash(path, size)) {}
+
+		PathKey(const std::string& path)
+			: PathKey(path.data(), path.size()) {}
+
+#if __cplusplus >= 201703L
+		constexpr PathKey(std::string_view path)
+			: PathKey(path.data(), path.size()) {}
+#endif
+	};
+}
+
+// Defined only when the resources were compiled with `rescomp -index`
+extern "C" const resman::detail::resource_index resman_resource_index;
+
+// Bounds of the section with all resource payloads, provided by the linker
+#if defined(__ELF__)
+extern "C" {
+	extern const char __start_resman[] __attribute__((weak, visibility("hidden")));
+	extern const char __stop_resman[] __attribute__((weak, visibility("hidden")));
+}
+#elif defined(__APPLE__)
+extern const char resman_section_start[] __asm("section$start$__TEXT$__resman");
+extern const char resman_section_end[] __asm("section$end$__TEXT$__resman");
+#endif
+
+// Set by the loader object of a resource pack (`rescomp -o <file>.rpak`)
+extern "C" const char* resman_pack_error;
+
+namespace resman {
+
+	// Contiguous read-only view of a resource as an array of T
+	template <typename T>
+	class Span {
+		T* ptr = nullptr;
+		std::size_t count = 0;
+
+	public:
+		Span() noexcept {}
+		Span(T* ptr, std::size_t count) noexcept : ptr(ptr), count(count) {}
+
+		T* data() const noexcept {
+			return ptr;
+		}
+		std::size_t size() const noexcept {
+			return count;
+		}
+		bool empty() const noexcept {
+			return count == 0;
+		}
+		T* begin() const noexcept {
+			return ptr;
+		}
+		T* end() const noexcept {
+			return ptr + count;
+		}
+		T& operator[](std::size_t i) const noexcept {
+			return ptr[i];
+		}
+
+#if __cplusplus >= 202002L
+		operator std::span<T>() const noexcept {
+			return std::span<T>(ptr, count);
+		}
+#endif
+	};
+
+	template <unsigned N, typename... Options>
 	struct Resource {
+		static constexpr unsigned alignment = detail::option_alignment<Options...>::value;
+		static_assert((alignment & (alignment - 1)) == 0, "Align<K> requires a power of two");
+
+		// resource_traits<N>, complete only if the header written by -traits-header is included
+		using traits = resource_traits<N>;
+
 		template <unsigned S>
 		constexpr Resource(const char (&path)[S]) {}
 
 	private:
 		friend ResourceHandle;
 
-		static const char storage_begin[];
-		static const unsigned storage_size;
+		alignas(alignment) static const char storage_begin[];
+		static const unsigned long long storage_size;
+		static const unsigned long long storage_raw_size; // only defined for compressed resources
+		static const unsigned long long storage_hash;
+		static const unsigned long long storage_alignment; // as placed by rescomp, Align<K> or -align
 	};
 
+	template <unsigned N, typename... Options>
+	constexpr unsigned Resource<N, Options...>::alignment;
+
 	class ResourceHandle {
 		const unsigned res_id = 0;
-		const unsigned res_byte_size = 0;
-		const char* res_begin_ptr = nullptr;
-		const char* res_end_ptr = nullptr;
+		const std::size_t res_byte_size = 0;
+		const std::size_t res_stored_size = 0;
+		const char* res_storage_ptr = nullptr;
+		const bool res_compressed = false;
+		const unsigned res_alignment = 1;
+		const unsigned long long res_hash = 0;
+		std::atomic<const char*>* const res_slot = nullptr; // only for compressed resources
+
+		template <typename R>
+		static std::size_t raw_size_of(std::true_type) {
+			return R::storage_raw_size;
+		}
+
+		template <typename R>
+		static std::size_t raw_size_of(std::false_type) {
+			return R::storage_size;
+		}
 
 	public:
-		template <unsigned N>
-		ResourceHandle(Resource<N>)
+		// Empty handle, returned by find() when there is no such resource
+		ResourceHandle() {}
+
+		explicit ResourceHandle(const detail::index_entry& entry)
+			: res_id(entry.id)
+			, res_byte_size(entry.raw_size ? *entry.raw_size : *entry.stored_size)
+			, res_stored_size(*entry.stored_size)
+			, res_storage_ptr(entry.storage)
+			, res_compressed(entry.raw_size != nullptr)
+			, res_alignment(entry.alignment)
+			, res_hash(*entry.hash)
+			, res_slot(entry.raw_size ? &detail::decompressed_slot(entry.storage) : nullptr)
+		{}
+
+		template <unsigned N, typename... Options>
+		ResourceHandle(Resource<N, Options...>)
 			: res_id(N)
-			, res_byte_size(Resource<N>::storage_size)
-			, res_begin_ptr(Resource<N>::storage_begin)
-			, res_end_ptr(res_begin_ptr + res_byte_size)
+			, res_byte_size(raw_size_of<Resource<N, Options...>>(detail::has_option<Compressed, Options...>()))
+			, res_stored_size(Resource<N, Options...>::storage_size)
+			, res_storage_ptr(Resource<N, Options...>::storage_begin)
+			, res_compressed(detail::has_option<Compressed, Options...>::value)
+			, res_alignment(static_cast<unsigned>(Resource<N, Options...>::storage_alignment))
+			, res_hash(Resource<N, Options...>::storage_hash)
+			, res_slot(detail::has_option<Compressed, Options...>::value
+				? &detail::decompressed_slot<Resource<N, Options...>>() : nullptr)
 		{}
 
-		const char* begin() {
-			return res_begin_ptr;
+		// For compressed resources, the first call decompresses the data and throws std::bad_alloc
+		// if there is not enough memory for it. The data stays valid until the program exits,
+		// views of it can be kept without copying.
+		const char* begin() const {
+			if (!res_compressed) {
+				return res_storage_ptr;
+			}
+			const char* data = res_slot->load(std::memory_order_acquire);
+			if (!data || reinterpret_cast<std::uintptr_t>(data) % res_alignment != 0) {
+				data = detail::decompressed_storage(res_storage_ptr, res_stored_size, res_byte_size, res_alignment);
+				res_slot->store(data, std::memory_order_release);
+			}
+			return data;
+		}
+		const char* end() const {
+			return begin() + res_byte_size;
 		}
-		const char* end() {
-			return res_end_ptr;
+		const char* data() const {
+			return begin();
 		}
-		unsigned size() {
+		// Uncompressed size
+		std::size_t size() const noexcept {
 			return res_byte_size;
 		}
-		unsigned id() {
+		unsigned id() const noexcept {
 			return res_id;
 		}
+		// XXH64 (seed 0) of the uncompressed contents, computed by rescomp.
+		// Compressed resources are not decompressed, an empty handle returns 0.
+		unsigned long long hash() const noexcept {
+			return res_hash;
+		}
+
+		Span<const char> bytes() const {
+			return Span<const char>(begin(), res_byte_size);
+		}
+#if __cplusplus >= 201703L
+		std::string_view view() const {
+			return std::string_view(begin(), res_byte_size);
+		}
+#endif
+
+		bool is_compressed() const noexcept {
+			return res_compressed;
+		}
+		// Size of the data embedded in the executable
+		std::size_t compressed_size() const noexcept {
+			return res_stored_size;
+		}
+		// Decompress (or copy) the resource into a caller-provided buffer of at least size() bytes
+		bool decompress(char* dest) const noexcept {
+			if (!res_compressed) {
+				std::memcpy(dest, res_storage_ptr, res_byte_size);
+				return true;
+			}
+			return detail::lz4_decompress(res_storage_ptr, res_stored_size, dest, res_byte_size);
+		}
+
+		// Guaranteed alignment of begin(), at least as requested by Align<K> or `rescomp -align`.
+		// Decompressed copies get the same alignment as the embedded data.
+		unsigned alignment() const noexcept {
+			return res_alignment;
+		}
+
+		// View of the resource as an array of T, e.g. as<const float>(). Trailing bytes that do not
+		// form a whole T are not included. Returns an empty span if the data is not aligned for T.
+		template <typename T>
+		Span<T> as() const {
+			static_assert(std::is_const<T>::value, "resources are read-only, use as<const T>()");
+			static_assert(std::is_trivially_copyable<T>::value, "resources can only be viewed as trivially copyable types");
+
+			const char* data = begin();
+			if (reinterpret_cast<std::uintptr_t>(data) % alignof(T) != 0) {
+				return Span<T>();
+			}
+			return Span<T>(reinterpret_cast<T*>(data), res_byte_size / sizeof(T));
+		}
+
+		// Ask the OS to start reading the embedded data in the background, so that the first
+		// access does not stall on page faults. Returns false if the platform has no such hint.
+		bool prefetch() const noexcept {
+			return detail::advise(res_storage_ptr, res_stored_size, true);
+		}
+		// Drop the pages of the embedded data from memory, they are read from the executable again
+		// on the next access. A decompressed copy of a compressed resource is not affected.
+		bool release() const noexcept {
+			return detail::advise(res_storage_ptr, res_stored_size, false);
+		}
+
+		explicit operator bool() const noexcept {
+			return res_storage_ptr != nullptr;
+		}
+	};
+
+	// Read-only stream buffer over the data of a resource, for parsers that take a std::istream.
+	// Reads and seeks work on the resource data in place, nothing is copied.
+	class ResourceBuf : public std::streambuf {
+	public:
+		ResourceBuf() {}
+
+		ResourceBuf(const char* data, std::size_t size) {
+			// the get area is never written to, putting back a different character fails
+			char* first = const_cast<char*>(data);
+			setg(first, first, first + size);
+		}
+
+		explicit ResourceBuf(const ResourceHandle& handle)
+			: ResourceBuf(handle.data(), handle.size()) {}
+
+	protected:
+		pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+			off_type base = 0;
+			if (dir == std::ios_base::cur) {
+				base = gptr() - eback();
+			}
+			else if (dir == std::ios_base::end) {
+				base = egptr() - eback();
+			}
+			return seekpos(pos_type(base + off), which);
+		}
+
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+			const off_type offset = pos;
+			if (!(which & std::ios_base::in) || offset < 0 || offset > egptr() - eback()) {
+				return pos_type(off_type(-1));
+			}
+			setg(eback(), eback() + offset, egptr());
+			return pos;
+		}
+
+		std::streamsize showmanyc() override {
+			return gptr() < egptr() ? egptr() - gptr() : -1;
+		}
+	};
+
+	// std::istream reading a resource, e.g. ResourceStream in(gConfig); parse(in);
+	class ResourceStream : public std::istream {
+		ResourceBuf buf;
+
+	public:
+		explicit ResourceStream(const ResourceHandle& handle)
+			: std::istream(nullptr), buf(handle) {
+			rdbuf(&buf);
+		}
 	};
+
+	// Consecutive pieces of a resource of at most chunk_size bytes, for consumers with an
+	// incremental interface (hashing, decoders, network writes). next() returns views of the
+	// resource data, read() copies into a caller-provided buffer.
+	class ChunkReader {
+		const char* pos = nullptr;
+		const char* last = nullptr;
+		std::size_t chunk = 0;
+
+	public:
+		explicit ChunkReader(const ResourceHandle& handle, std::size_t chunk_size = 65536)
+			: pos(handle.data()), last(pos + handle.size()), chunk(chunk_size ? chunk_size : 1) {}
+
+		// The next chunk, empty at the end of the resource
+		Span<const char> next() noexcept {
+			const std::size_t count = remaining() < chunk ? remaining() : chunk;
+			Span<const char> piece(pos, count);
+			pos += count;
+			return piece;
+		}
+
+		// Copies up to n bytes into dest and returns their number, 0 at the end of the resource
+		std::size_t read(char* dest, std::size_t n) noexcept {
+			const std::size_t count = remaining() < n ? remaining() : n;
+			if (count) {
+				std::memcpy(dest, pos, count);
+				pos += count;
+			}
+			return count;
+		}
+
+		std::size_t remaining() const noexcept {
+			return static_cast<std::size_t>(last - pos);
+		}
+		bool done() const noexcept {
+			return pos == last;
+		}
+	};
+
+	// Payloads of all resources linked into this module (executable or shared library),
+	// empty on platforms where the section bounds are not available.
+	// On ELF, calling this (or prefetch_all()/release_all()) refers to __start_resman, which makes
+	// the linker keep all resources under --gc-sections, unused ones from `rescomp -data-sections` too.
+	inline Span<const char> section() {
+#if defined(__ELF__)
+		if (!__start_resman || !__stop_resman) {
+			return Span<const char>();
+		}
+		return Span<const char>(__start_resman, __stop_resman - __start_resman);
+#elif defined(__APPLE__)
+		return Span<const char>(resman_section_start, resman_section_end - resman_section_start);
+#else
+		return Span<const char>();
+#endif
+	}
+
+	inline bool prefetch_all() {
+		Span<const char> data = section();
+		return !data.empty() && detail::advise(data.data(), data.size(), true);
+	}
+
+	inline bool release_all() {
+		Span<const char> data = section();
+		return !data.empty() && detail::advise(data.data(), data.size(), false);
+	}
+
+	// Null if the resource packs linked into the program were mapped at startup, otherwise why not.
+	// Resources of a pack that could not be mapped have no data, size() returns 0 for them.
+	// Only available in programs which link the loader object of a pack.
+	inline const char* pack_error() noexcept {
+		return resman_pack_error;
+	}
+
+	// Runtime lookup by ID in constant time, requires `rescomp -index`.
+	// Returns an empty handle if no resource has this ID.
+	inline ResourceHandle find(unsigned id) {
+		const detail::resource_index& index = resman_resource_index;
+		if (index.entry_count == 0) {
+			return ResourceHandle();
+		}
+
+		unsigned bucket = detail::index_hash(id, 0) % index.bucket_count;
+		unsigned slot = detail::index_hash(id, index.seeds[bucket]) % index.slot_count;
+		unsigned entry = index.slots[slot];
+		if (entry == ~0u || index.entries[entry].id != id) {
+			return ResourceHandle();
+		}
+		return ResourceHandle(index.entries[entry]);
+	}
+
+	// Runtime lookup by the path written in the Resource declaration (e.g. "shaders/blur.frag"),
+	// costs a hash and a single comparison. Requires `rescomp -index`.
+	// If the same path is declared under several IDs, the lowest one is returned.
+	inline ResourceHandle find(const PathKey& key) {
+		const detail::resource_index& index = resman_resource_index;
+		if (index.entry_count == 0) {
+			return ResourceHandle();
+		}
+
+		unsigned bucket = static_cast<unsigned>(detail::path_slot_hash(key.hash, 0) % index.path_bucket_count);
+		unsigned slot = static_cast<unsigned>(detail::path_slot_hash(key.hash, index.path_seeds[bucket]) % index.path_slot_count);
+		unsigned entry = index.path_slots[slot];
+		if (entry == ~0u) {
+			return ResourceHandle();
+		}
+
+		const detail::index_entry& candidate = index.entries[entry];
+		if (candidate.path_size != key.size || std::memcmp(candidate.path, key.path, key.size) != 0) {
+			return ResourceHandle();
+		}
+		return ResourceHandle(candidate);
+	}
+
+	// All embedded resources in the order of their IDs, requires `rescomp -index`
+	class ResourceRange {
+		const detail::index_entry* first;
+		const detail::index_entry* last;
+
+	public:
+		class iterator {
+			const detail::index_entry* entry;
+
+		public:
+			explicit iterator(const detail::index_entry* entry) : entry(entry) {}
+
+			ResourceHandle operator*() const {
+				return ResourceHandle(*entry);
+			}
+			iterator& operator++() {
+				++entry;
+				return *this;
+			}
+			bool operator==(const iterator& other) const {
+				return entry == other.entry;
+			}
+			bool operator!=(const iterator& other) const {
+				return entry != other.entry;
+			}
+		};
+
+		ResourceRange(const detail::index_entry* first, const detail::index_entry* last) : first(first), last(last) {}
+
+		iterator begin() const {
+			return iterator(first);
+		}
+		iterator end() const {
+			return iterator(last);
+		}
+		unsigned size() const {
+			return static_cast<unsigned>(last - first);
+		}
+	};
+
+	inline ResourceRange resources() {
+		const detail::resource_index& index = resman_resource_index;
+		return ResourceRange(index.entries, index.entries + index.entry_count);
+	}
 }
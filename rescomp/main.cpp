@@ -6,24 +6,56 @@
 #include <clang/Frontend/ASTConsumers.h>
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Frontend/FrontendActions.h>
+#include <clang/Basic/Version.h>
 #include <clang/Tooling/CommonOptionsParser.h>
 #include <clang/Tooling/Tooling.h>
 
 #include <llvm/IR/Verifier.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Support/Host.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Error.h>
 #include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/ManagedStatic.h>
+#include <llvm/Support/StringSaver.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/Process.h>
 
 #include <iostream>
 #include <utility>
 #include <string>
 #include <algorithm>
+#include <chrono>
+#include <exception>
+#include <numeric>
+#include <map>
+#include <mutex>
+#include <set>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #include "../common/fsutil.h"
 #include "../common/fileio.h"
 #include "../common/objcompiler.h"
+#include "../common/objwriter.h"
+#include "../common/objcache.h"
+#include "../common/packfile.h"
+#include "../common/resindex.h"
+#include "../common/depfile.h"
+#include "../common/hash.h"
+#include "../common/payload.h"
 #include "../common/libpacker.h"
+#include "../common/phasestats.h"
+#include "../common/server.h"
+#include "../common/declscan.h"
+#include "../common/traitsheader.h"
+#include "../common/transform.h"
 #include "../common/exceptions.h"
 
 using namespace clang;
@@ -38,20 +70,132 @@ constexpr const char libext[] = ".lib";
 constexpr const char objext[] = ".o";
 constexpr const char libext[] = ".a";
 #endif
+constexpr const char packext[] = ".rpak";
 
 static llvm::cl::OptionCategory ToolingResCompCategory("Resource Compiler");
 //static llvm::cl::extrahelp CommonHelp(CommonOptionsParser::HelpMessage);
 
 static llvm::cl::opt<std::string> OutputFilePath("o",
-	llvm::cl::Required,
 	llvm::cl::desc("Specify output file"),
 	llvm::cl::value_desc("path"),
 	llvm::cl::cat(ToolingResCompCategory));
 
+static llvm::cl::opt<std::string> BatchManifest("batch",
+	llvm::cl::desc("Compile every output listed in the manifest in one process, one per line:\n"
+		"-o <output> <input>... [-R <directory>]... [-I <directory>]...\n"
+		"(replaces -o and inputs, other options apply to all outputs)"),
+	llvm::cl::value_desc("manifest"),
+	llvm::cl::cat(ToolingResCompCategory));
+
 static llvm::cl::opt<std::string> MArch("march",
 	llvm::cl::desc("Architecture to generate code for (native by default)"),
 	llvm::cl::cat(ToolingResCompCategory));
 
+static llvm::cl::opt<bool> DirectObj("direct",
+	llvm::cl::desc("Write the object file directly instead of using LLVM code generation\n"
+		"(64-bit ELF targets only, other targets fall back to LLVM)"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<bool> DataSections("data-sections",
+	llvm::cl::desc("Let the linker drop resources the program does not use: static libraries get one\n"
+		"member per resource, object files a COMDAT section group per resource"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<unsigned> Jobs("j",
+	llvm::cl::desc("Number of parallel jobs used to emit static libraries (0 = all cores)"),
+	llvm::cl::value_desc("N"),
+	llvm::cl::init(1),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<std::string> CacheDir("cache-dir",
+	llvm::cl::desc("Cache compiled resources in this directory and reuse them across runs\n"
+		"(static library output only)"),
+	llvm::cl::value_desc("directory"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<unsigned> MinAlignment("align",
+	llvm::cl::desc("Minimum alignment of resource data in bytes (power of two),\n"
+		"Resource<N, resman::Align<K>> can raise it for a single resource"),
+	llvm::cl::value_desc("bytes"),
+	llvm::cl::init(1),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<bool> GenIndex("index",
+	llvm::cl::desc("Emit a runtime index of all resources for resman::find and resman::resources\n"
+		"(only one output linked into a program may contain it)"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<std::string> PackRuntimePath("pack-path",
+	llvm::cl::desc("Path the program opens the pack file from at startup, relative paths are\n"
+		"relative to the executable (.rpak output only, file name of the output by default)"),
+	llvm::cl::value_desc("path"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+// LLVM already registers -stats and -stats-json for its own statistics
+static llvm::cl::opt<std::string> PhaseStatsPath("phase-stats",
+	llvm::cl::desc("Write time, bytes processed and peak memory of each phase as JSON ('-' for stdout)"),
+	llvm::cl::value_desc("path"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<std::string> PhaseTracePath("phase-trace",
+	llvm::cl::desc("Write the phases as a Chrome trace event file (chrome://tracing)"),
+	llvm::cl::value_desc("path"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<bool> FullParse("full-parse",
+	llvm::cl::desc("Always parse input headers with Clang, even if they only contain\n"
+		"canonical resource declarations the fast scanner understands"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<bool> UsePCH("pch",
+	llvm::cl::desc("Parse resman.h (and -pch-include headers) once into a precompiled header\n"
+		"shared by all input headers, kept in -cache-dir or the temporary directory"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::list<std::string> PCHIncludes("pch-include",
+	llvm::cl::desc("Header included by many input headers to add to the precompiled header (implies -pch)"),
+	llvm::cl::value_desc("header"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<std::string> ServerSocket("server",
+	llvm::cl::desc("Keep running and compile the requests of clients on this local socket,\n"
+		"rescomp forwards its command line to the server if RESCOMP_SERVER is set to the socket"),
+	llvm::cl::value_desc("socket"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<std::string> TraitsHeaderPath("traits-header",
+	llvm::cl::desc("Write a header with resman::resource_traits<N> for every resource:\n"
+		"size, alignment and content hash as constant expressions"),
+	llvm::cl::value_desc("path"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<unsigned> TraitsInlineLimit("traits-inline",
+	llvm::cl::desc("Include the contents of resources up to this size in the traits header"),
+	llvm::cl::value_desc("bytes"),
+	llvm::cl::init(0),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::list<std::string> TransformRuleArgs("transform",
+	llvm::cl::desc("Transform the contents of resources whose declared path matches the glob:\n"
+		"null-terminate, strip-comments, strip-whitespace, minify-json, base64-decode\n"
+		"or cmd:<shell command> (stdin to stdout), a list is applied in order"),
+	llvm::cl::value_desc("glob=transform[,transform...]"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<bool> GenDepFile("MD",
+	llvm::cl::desc("Write a Make/Ninja dependency file listing all parsed headers and resource files"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<std::string> DepFilePath("MF",
+	llvm::cl::desc("Dependency file path (implies -MD, <output>.d by default)"),
+	llvm::cl::value_desc("path"),
+	llvm::cl::cat(ToolingResCompCategory));
+
+static llvm::cl::opt<std::string> DepTarget("MT",
+	llvm::cl::desc("Target name used in the dependency file (output path by default)"),
+	llvm::cl::value_desc("target"),
+	llvm::cl::cat(ToolingResCompCategory));
+
 static llvm::cl::list<std::string> ResSearchPath("R",
 	llvm::cl::desc("Resource search path (can be used more than once for multiple paths)"),
 	llvm::cl::value_desc("directory"),
@@ -63,11 +207,12 @@ static llvm::cl::list<std::string> HdrSearchPath("I",
 	llvm::cl::cat(ToolingResCompCategory));
 
 
-static llvm::LLVMContext llvmCtxt;
-
 class RescompContext {
+	llvm::LLVMContext llvmCtxt; // one per output, so that outputs can be compiled concurrently
 	std::unique_ptr<llvm::Module> pMod;
 	llvm::DenseMap<unsigned, SourceLocation> resMap;
+	std::vector<ResourceEntry> resources;
+	std::set<std::string> headers;
 
 public:
 	RescompContext(StringRef moduleName) : pMod(new llvm::Module(moduleName, llvmCtxt)) {}
@@ -79,51 +224,14 @@ public:
 	llvm::DenseMap<unsigned, SourceLocation>& getResourceDefs() {
 		return resMap;
 	}
-};
-
-struct MangledStorageGlobals {
-	std::string storageBegin;
-	std::string storageSize;
-};
-
-class MangleStorageNamesASTVisitor : public RecursiveASTVisitor<MangleStorageNamesASTVisitor> {
-	uint64_t resourceID;
-	std::string resourcePath;
-	MangledStorageGlobals& mangledGlob;
-public:
-	MangleStorageNamesASTVisitor(uint64_t resID, const std::string& resPath, MangledStorageGlobals& glob)
-		: resourceID(resID), resourcePath(resPath), mangledGlob(glob) {}
 
-	bool VisitVarDecl(VarDecl* decl) {
-		if (!decl->isStaticDataMember()
-			|| !decl->getMemberSpecializationInfo()
-			|| !decl->isDefinedOutsideFunctionOrMethod()
-			|| !decl->isThisDeclarationADefinition()
-			|| !StringRef(decl->getQualifiedNameAsString()).startswith("resman::Resource")) {
-			return true;
-		}
-
-		std::string mangledVarName;
-		std::unique_ptr<MangleContext> mangleCtxt{decl->getASTContext().createMangleContext()};
-
-		if (!mangleCtxt->shouldMangleDeclName(decl)) {
-			return true;
-		}
-
-		{
-			llvm::raw_string_ostream strout(mangledVarName);
-			mangleCtxt->mangleName(decl, strout);
-			strout.str();
-		}
-
-		if (mangledVarName.find("begin") != std::string::npos) {
-			mangledGlob.storageBegin = mangledVarName;
-		}
-		else if (mangledVarName.find("size") != std::string::npos) {
-			mangledGlob.storageSize = mangledVarName;
-		}
+	std::vector<ResourceEntry>& getResources() {
+		return resources;
+	}
 
-		return true;
+	// absolute paths of all input headers and files they include
+	std::set<std::string>& getHeaders() {
+		return headers;
 	}
 };
 
@@ -131,6 +239,7 @@ class CompileResourcesASTVisitor : public RecursiveASTVisitor<CompileResourcesAS
 	ASTContext& astCtxt;
 	ArrayRef<StringRef> searchPath;
 	RescompContext& resCtxt;
+	std::unique_ptr<MangleContext> mangleCtxt;
 
 	struct CustomErrors {
 		unsigned resourceRedefined;
@@ -147,7 +256,104 @@ class CompileResourcesASTVisitor : public RecursiveASTVisitor<CompileResourcesAS
 		{}
 	} customErrors;
 
-	bool constructStorageGlobals(uint64_t resourceID, const std::string& resourcePath, SourceLocation location) {
+	// The Resource<N> specialization is already instantiated in the parsed header,
+	// so the storage members can be mangled directly from its declarations.
+	bool mangleStorageNames(const CXXRecordDecl* resourceSpec, bool compressed, StorageNames& names) {
+		for (auto member : resourceSpec->decls()) {
+			auto var = dyn_cast<VarDecl>(member);
+			if (!var || !var->isStaticDataMember() || !mangleCtxt->shouldMangleDeclName(var)) {
+				continue;
+			}
+
+			std::string* mangledVarName = nullptr;
+			if (var->getName() == "storage_begin") {
+				mangledVarName = &names.begin;
+			}
+			else if (var->getName() == "storage_size") {
+				mangledVarName = &names.size;
+			}
+			else if (var->getName() == "storage_raw_size" && compressed) {
+				mangledVarName = &names.rawSize;
+			}
+			else if (var->getName() == "storage_hash") {
+				mangledVarName = &names.hash;
+			}
+			else if (var->getName() == "storage_alignment") {
+				mangledVarName = &names.alignment;
+			}
+			else {
+				continue;
+			}
+
+			llvm::raw_string_ostream strout(*mangledVarName);
+			mangleCtxt->mangleName(var, strout);
+			strout.flush();
+		}
+
+		return !names.begin.empty() && !names.size.empty() && !names.hash.empty() && !names.alignment.empty()
+			&& (!compressed || !names.rawSize.empty());
+	}
+
+	struct ResourceOptions {
+		bool compressed = false;
+		uint64_t alignment = 1;
+		std::vector<std::string> transforms; // in the order of the options
+	};
+
+	// Options of Resource<N, Options...> are tag types: resman::Compressed, resman::Align<K>
+	// and the transforms (resman::NullTerminate, ...)
+	static ResourceOptions getResourceOptions(const CXXRecordDecl* resourceSpec) {
+		ResourceOptions options;
+		auto spec = dyn_cast<ClassTemplateSpecializationDecl>(resourceSpec);
+		if (!spec) {
+			return options;
+		}
+
+		const auto& tmplArgs = spec->getTemplateArgs();
+		for (unsigned i = 1; i < tmplArgs.size(); ++i) {
+			if (tmplArgs[i].getKind() != TemplateArgument::ArgKind::Pack) {
+				continue;
+			}
+			for (const auto& option : tmplArgs[i].pack_elements()) {
+				if (option.getKind() != TemplateArgument::ArgKind::Type) {
+					continue;
+				}
+				auto optionDecl = option.getAsType()->getAsCXXRecordDecl();
+				if (!optionDecl) {
+					continue;
+				}
+
+				static const std::map<std::string, const char*> transformOptions{
+					{ "resman::NullTerminate", "null-terminate" },
+					{ "resman::StripComments", "strip-comments" },
+					{ "resman::StripWhitespace", "strip-whitespace" },
+					{ "resman::MinifyJson", "minify-json" },
+					{ "resman::Base64Decode", "base64-decode" },
+				};
+
+				auto optionName = optionDecl->getQualifiedNameAsString();
+				auto transform = transformOptions.find(optionName);
+				if (optionName == "resman::Compressed") {
+					options.compressed = true;
+				}
+				else if (transform != transformOptions.end()) {
+					options.transforms.push_back(transform->second);
+				}
+				else if (optionName == "resman::Align") {
+					auto alignSpec = dyn_cast<ClassTemplateSpecializationDecl>(optionDecl);
+					if (alignSpec && alignSpec->getTemplateArgs().size() == 1
+						&& alignSpec->getTemplateArgs()[0].getKind() == TemplateArgument::ArgKind::Integral) {
+						options.alignment = std::max<uint64_t>(options.alignment,
+							alignSpec->getTemplateArgs()[0].getAsIntegral().getZExtValue());
+					}
+				}
+			}
+		}
+		return options;
+	}
+
+	bool constructStorageGlobals(uint64_t resourceID, const std::string& resourcePath,
+		const CXXRecordDecl* resourceSpec, SourceLocation location) {
 		auto& resDefs = resCtxt.getResourceDefs();
 		auto alreadyDefined = resDefs.find(resourceID);
 
@@ -160,41 +366,31 @@ class CompileResourcesASTVisitor : public RecursiveASTVisitor<CompileResourcesAS
 		}
 		resDefs.insert({resourceID, location});
 
-		std::string code;
-		llvm::raw_string_ostream codestream(code);
-		codestream << "namespace resman {\n";
-		codestream << R"__(
-template <unsigned N>
-struct Resource {
-private:
-	static const char storage_begin[];
-	static const unsigned storage_size;
-};
-		)__";
-		codestream << "template <> const char Resource<" << resourceID << ">::storage_begin[] = \"dummy\";\n";
-		codestream << "template <> const unsigned Resource<" << resourceID << ">::storage_size{6};\n";
-		codestream << "}";
-
-		auto ast = buildASTFromCode(codestream.str());
-		if (ast) {
-			MangledStorageGlobals glob;
-			MangleStorageNamesASTVisitor mangleNamesVisitor(resourceID, resourcePath, glob);
-			mangleNamesVisitor.TraverseDecl(ast->getASTContext().getTranslationUnitDecl());
-
-			auto expectedData = readFileIntoMemory(resourcePath, searchPath);
-			if (auto err = expectedData.takeError()) {
-				llvm::handleAllErrors(std::move(err), [&](const llvm::ECError& ecErr) {
-					auto& diagEngine = astCtxt.getDiagnostics();
-					auto diagBuilder = diagEngine.Report(location, customErrors.cannotOpenResource);
-					diagBuilder.AddString(resourcePath);
-					diagBuilder.AddString(ecErr.message());
-				});
-				return true;
-			}
+		if (!resourceSpec) {
+			return true;
+		}
+		StorageNames names;
+		auto options = getResourceOptions(resourceSpec);
+		if (!mangleStorageNames(resourceSpec, options.compressed, names)) {
+			return true;
+		}
 
-			addDataToModule(*expectedData, glob.storageBegin, glob.storageSize, resCtxt.getModule(), llvmCtxt);
+		auto expectedPath = findResourceFile(resourcePath, searchPath);
+		if (auto err = expectedPath.takeError()) {
+			llvm::handleAllErrors(std::move(err), [&](const llvm::ECError& ecErr) {
+				auto& diagEngine = astCtxt.getDiagnostics();
+				auto diagBuilder = diagEngine.Report(location, customErrors.cannotOpenResource);
+				diagBuilder.AddString(resourcePath);
+				diagBuilder.AddString(ecErr.message());
+			});
+			return true;
 		}
 
+		// Contents are read later, when the output is being emitted
+		resCtxt.getResources().push_back({resourceID, *expectedPath, resourcePath, names, options.compressed,
+			std::max<uint64_t>(options.alignment, MinAlignment)});
+		resCtxt.getResources().back().transforms = std::move(options.transforms);
+
 		return true;
 	}
 
@@ -217,7 +413,8 @@ private:
 
 public:
 	CompileResourcesASTVisitor(ASTContext& ctxt, ArrayRef<StringRef> paths, RescompContext& rctxt)
-		: astCtxt(ctxt), searchPath(paths), resCtxt(rctxt), customErrors(ctxt.getDiagnostics()) {}
+		: astCtxt(ctxt), searchPath(paths), resCtxt(rctxt)
+		, mangleCtxt(ctxt.createMangleContext()), customErrors(ctxt.getDiagnostics()) {}
 
 	bool VisitVarDecl(VarDecl* decl) {
 		if (!decl->isConstexpr()
@@ -260,7 +457,7 @@ public:
 		std::string resourcePath = pathValue->getString();
 
 		//llvm::outs() << "Resource: ID = " << resourceID << ", PATH = \"" << resourcePath << "\"\n";
-		return constructStorageGlobals(resourceID, resourcePath, decl->getLocation());
+		return constructStorageGlobals(resourceID, resourcePath, decl->getType()->getAsCXXRecordDecl(), decl->getLocation());
 	}
 };
 
@@ -273,31 +470,54 @@ public:
 		: searchPath(paths), resCtxt(rctxt) {}
 
 	void HandleTranslationUnit(clang::ASTContext& ctxt) override {
-		CompileResourcesASTVisitor visitor(ctxt, searchPath, resCtxt);
-		visitor.TraverseDecl(ctxt.getTranslationUnitDecl());
+		auto& srcMgr = ctxt.getSourceManager();
+		{
+			PhaseStats::Scope phase("mangle", srcMgr.getFileEntryForID(srcMgr.getMainFileID())->getName());
+			CompileResourcesASTVisitor visitor(ctxt, searchPath, resCtxt);
+			// declarations of a precompiled header are not loaded, resources are never declared there
+			for (auto decl : ctxt.getTranslationUnitDecl()->noload_decls()) {
+				visitor.TraverseDecl(decl);
+			}
+		}
+
+		// Every file entered by the preprocessor is a dependency of the output
+		for (auto it = srcMgr.fileinfo_begin(); it != srcMgr.fileinfo_end(); ++it) {
+			resCtxt.getHeaders().insert(makeAbsolute(it->first->getName()));
+		}
 	}
 };
 
+// Force C++ language even for .h files.
+// The precompiled header is built with the same options, Clang only accepts it if they match.
+static void setResCompLanguage(CompilerInstance& CI, TranslationUnitKind tuKind) {
+	auto& invocation = CI.getInvocation();
+	auto& langOpts = CI.getLangOpts();
+	langOpts.CPlusPlus = 1;
+	langOpts.CXXExceptions = 1;
+	langOpts.RTTI = 1;
+
+	auto& triple = CI.getTarget().getTriple();
+	auto& ppOpts = CI.getPreprocessorOpts();
+	invocation.setLangDefaults(langOpts, InputKind::CXX, triple, ppOpts, LangStandard::lang_cxx17);
+	CI.createPreprocessor(tuKind);
+	CI.createASTContext();
+}
+
 class ResCompFrontendAction : public ASTFrontendAction {
 	std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& CI, StringRef file) override {
-		// force C++ language even for .h files
-		auto& invocation = CI.getInvocation();
-		auto& langOpts = CI.getLangOpts();
-		langOpts.CPlusPlus = 1;
-		langOpts.CXXExceptions = 1;
-		langOpts.RTTI = 1;
-
-		auto& triple = CI.getTarget().getTriple();
-		auto& ppOpts = CI.getPreprocessorOpts();
-		invocation.setLangDefaults(langOpts, InputKind::CXX, triple, ppOpts, LangStandard::lang_cxx17);
-		CI.createPreprocessor(TU_Module);
-		CI.createASTContext();
+		setResCompLanguage(CI, TU_Module);
 
 		inputDirectory = removeFilename(file);
 		resSearchPath.back() = inputDirectory;
 		return std::make_unique<ResCompASTConsumer>(resSearchPath, resCtxt);
 	}
 
+	// Parsing includes the AST traversal, which is also recorded on its own
+	void ExecuteAction() override {
+		PhaseStats::Scope phase("parse", getCurrentFile());
+		ASTFrontendAction::ExecuteAction();
+	}
+
 	std::vector<StringRef> resSearchPath;
 	std::string inputDirectory;
 	RescompContext& resCtxt;
@@ -308,6 +528,20 @@ public:
 	}
 };
 
+class ResCompPCHAction : public GeneratePCHAction {
+	std::string outputPath;
+
+	std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& CI, StringRef file) override {
+		setResCompLanguage(CI, getTranslationUnitKind());
+		// written into a temporary file and renamed, concurrent builds of the same header are harmless
+		CI.getFrontendOpts().OutputFile = outputPath;
+		return GeneratePCHAction::CreateASTConsumer(CI, file);
+	}
+
+public:
+	ResCompPCHAction(std::string path) : outputPath(std::move(path)) {}
+};
+
 template <typename F>
 std::unique_ptr<FrontendActionFactory> newFrontendActionFactoryFromLambda(F construct) {
 	class LambdaFrontendActionFactory : public FrontendActionFactory {
@@ -322,11 +556,12 @@ std::unique_ptr<FrontendActionFactory> newFrontendActionFactoryFromLambda(F cons
 
 class ObjOrLibPath {
 	enum class Type {
-		Obj, Lib
+		Obj, Lib, Pack
 	} type;
 
 	std::string objPath;
 	std::string libPath;
+	std::string packPath;
 
 	static Type getOutputType(StringRef path) {
 		if (path.endswith(objext)) {
@@ -335,14 +570,24 @@ class ObjOrLibPath {
 		if (path.endswith(libext)) {
 			return Type::Lib;
 		}
-		throw filetype_error("Output must be object file or static library.");
+		if (path.endswith(packext)) {
+			return Type::Pack;
+		}
+		throw filetype_error("Output must be object file, static library or pack file.");
 	}
 
 public:
 	ObjOrLibPath(StringRef path)
 		: type(getOutputType(path))
 		, objPath(type == Type::Obj ? path : "")
-		, libPath(type == Type::Lib ? path : "") {
+		, libPath(type == Type::Lib ? path : "")
+		, packPath(type == Type::Pack ? path : "") {
+		if (type == Type::Pack) {
+			// the loader object goes next to the pack: assets.rpak -> assets.o
+			llvm::SmallString<260> filePath{ packPath };
+			llvm::sys::path::replace_extension(filePath, objext);
+			objPath = filePath.str();
+		}
 		if (type == Type::Lib) {
 			using namespace std::string_literals;
 
@@ -351,13 +596,17 @@ public:
 			filePath += "-%%%%%%%"s + objext;
 			objPath = filePath.str();
 		}
-		// if type == Type::Obj, we won't need the libPath
+		// if type == Type::Obj, we won't need the libPath or packPath
 	}
 
 	bool isLib() const {
 		return type == Type::Lib;
 	}
 
+	bool isPack() const {
+		return type == Type::Pack;
+	}
+
 	const std::string& obj() const {
 		return objPath;
 	}
@@ -365,6 +614,10 @@ public:
 	const std::string& lib() const {
 		return libPath;
 	}
+
+	const std::string& pack() const {
+		return packPath;
+	}
 };
 
 class OpenOutputObjFile {
@@ -402,85 +655,1015 @@ public:
 		: OpenOutputObjFile(output), llvm::ToolOutputFile(actualPath, fd) {}
 };
 
+struct FileStamp {
+	llvm::sys::TimePoint<> mtime;
+	uint64_t size;
+
+	bool operator==(const FileStamp& other) const {
+		return mtime == other.mtime && size == other.size;
+	}
+};
+
+static bool getFileStamp(const std::string& path, FileStamp& stamp) {
+	llvm::sys::fs::file_status status;
+	if (llvm::sys::fs::status(path, status)) {
+		return false;
+	}
+	stamp = { status.getLastModificationTime(), status.getSize() };
+	return true;
+}
+
+// A file modified within the timestamp resolution before it was read
+// may change again without its stamp changing
+static bool isSettled(const FileStamp& stamp, llvm::sys::TimePoint<> readTime) {
+	return stamp.mtime + std::chrono::seconds(1) < readTime;
+}
+
+// The server keeps the results of parsing between requests,
+// they are reused as long as none of the parsed files changes
+class ParseCache {
+	struct Entry {
+		std::vector<ResourceEntry> resources;
+		std::set<std::string> headers;
+		std::vector<std::pair<std::string, FileStamp>> stamps; // of the headers
+	};
+
+	std::mutex mutex;
+	std::map<std::string, Entry> entries;
+
+public:
+	bool lookup(const std::string& key, RescompContext& resCtxt) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = entries.find(key);
+		if (it == entries.end()) {
+			return false;
+		}
+
+		bool valid = true;
+		for (const auto& stamp : it->second.stamps) {
+			FileStamp current;
+			valid = valid && getFileStamp(stamp.first, current) && current == stamp.second;
+		}
+		// contents of resource files are read for every request, they only have to exist;
+		// a new file earlier in the search path is not noticed until a header changes
+		for (const auto& res : it->second.resources) {
+			valid = valid && llvm::sys::fs::exists(res.path);
+		}
+		if (!valid) {
+			entries.erase(it);
+			return false;
+		}
+		resCtxt.getResources() = it->second.resources;
+		resCtxt.getHeaders() = it->second.headers;
+		return true;
+	}
+
+	void store(const std::string& key, RescompContext& resCtxt, llvm::sys::TimePoint<> parseTime) {
+		Entry entry{ resCtxt.getResources(), resCtxt.getHeaders(), {} };
+		for (const auto& header : entry.headers) {
+			FileStamp stamp;
+			if (!getFileStamp(header, stamp) || !isSettled(stamp, parseTime)) {
+				return;
+			}
+			entry.stamps.push_back({ header, stamp });
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		entries[key] = std::move(entry);
+	}
+};
+
+// Sizes and hashes of resource contents for deduplication, reused while the files are unchanged
+class ContentHashCache {
+	struct Entry {
+		FileStamp stamp;
+		std::pair<uint64_t, uint64_t> sizeAndHash;
+	};
+
+	std::mutex mutex;
+	std::map<std::string, Entry> entries;
+
+public:
+	std::pair<uint64_t, uint64_t> get(const ResourceEntry& res) {
+		// the stamp is taken before reading, a change while reading makes it outdated
+		auto readTime = std::chrono::system_clock::now();
+		FileStamp stamp;
+		bool cacheable = getFileStamp(res.path, stamp) && isSettled(stamp, readTime);
+		if (cacheable) {
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = entries.find(res.path);
+			if (it != entries.end() && it->second.stamp == stamp) {
+				return it->second.sizeAndHash;
+			}
+		}
+
+		auto data = mapResourceFile(res);
+		std::pair<uint64_t, uint64_t> sizeAndHash{ data->getBufferSize(), hashContents(data->getBuffer()) };
+		if (cacheable) {
+			std::lock_guard<std::mutex> lock(mutex);
+			entries[res.path] = { stamp, sizeAndHash };
+		}
+		return sizeAndHash;
+	}
+};
+
+static ParseCache parseCache;
+static ContentHashCache contentHashes;
+static bool keepParsedInputs = false; // only the server sees the same inputs again
+static bool scanDeclarations = false; // set per invocation, see canScanDeclarations
+static std::vector<TransformRule> transformRules; // set per invocation from -transform
+
 // Construct command-line options for each parsed file
-static CommandLineArguments createPerFileCmdLine(StringRef progDir) {
+static CommandLineArguments createPerFileCmdLine(StringRef progDir, ArrayRef<std::string> hdrSearchPath) {
 	CommandLineArguments result;
 	// Include search path will contain program directory by default
 	result.insert(result.end(), {"-I", progDir});
 	//llvm::outs() << "progDir: " << progDir << '\n';
 
-	for (const auto& p : HdrSearchPath) {
+	for (const auto& p : hdrSearchPath) {
 		// and also any additional paths provided by user
 		result.insert(result.end(), {"-I", p});
 	}
 	return result;
 }
 
-std::string getProgDir(const char* argv0) {
-	return removeFilename(llvm::sys::fs::getMainExecutable(argv0, (void*)(intptr_t)getProgDir));
+// Read all resource files and fill the module for LLVM code generation
+static void compileResources(ArrayRef<ResourceEntry> resources, llvm::Module& mod, bool pageAlignSection) {
+	std::string section = getResourceSectionName();
+	for (const auto& res : resources) {
+		// The section gets its alignment from the first payload in it
+		bool first = &res == &resources.front();
+		uint64_t alignment = first && pageAlignSection ? std::max(res.alignment, resourceSectionAlignment) : res.alignment;
+
+		// Uncompressed payloads go straight from the mapped file into the module
+		auto payload = loadPayload(res);
+		PhaseStats::Scope phase("add_data", res.path, payload->getBufferSize());
+		auto storage = addDataToModule(payload->getBuffer(), res.names.begin, res.names.size, alignment,
+			mod, mod.getContext());
+		storage->setSection(section);
+		if (res.compressed) {
+			addIntegerToModule(mapResourceFile(res)->getBufferSize(), res.names.rawSize, mod, mod.getContext());
+		}
+		addIntegerToModule(res.hash, res.names.hash, mod, mod.getContext());
+		addIntegerToModule(res.alignment, res.names.alignment, mod, mod.getContext());
+
+		for (const auto& alias : res.aliases) {
+			addAliasToModule(alias.names.begin, res.names.begin, mod);
+			addAliasToModule(alias.names.size, res.names.size, mod);
+			addAliasToModule(alias.names.hash, res.names.hash, mod);
+			addAliasToModule(alias.names.alignment, res.names.alignment, mod);
+			if (res.compressed) {
+				addAliasToModule(alias.names.rawSize, res.names.rawSize, mod);
+			}
+		}
+
+		// static libraries already have a member per resource
+		if (DataSections && resources.size() > 1) {
+			addResourceComdat(res.names, mod);
+		}
+	}
+
+	llvm::verifyModule(mod);
 }
 
-int main(int argc, const char *argv[]) {
-	using namespace std::string_literals;
+static bool useDirectObjectWriter() {
+	return DirectObj && canWriteObjectFileDirect(MArch);
+}
 
-	std::vector<const char*> args(argv, argv + argc);
-	int argCnt = argc;
-	auto it = std::find(args.cbegin(), args.cend(), "--"s);
-	if (it == args.cend()) {
-		// We don't want to work with compilation databases.
-		// If the `--` option wasn't specified, pretend it was.
-		args.push_back("--");
-		argCnt++;
+// Objects of a single resource are static library members of which many get linked,
+// page-aligning each of them would pad every resource to a page
+static void emitObjectFile(ArrayRef<ResourceEntry> resources, llvm::Module& mod, llvm::ToolOutputFile& objFile,
+	const ResourceIndex* index = nullptr) {
+	bool pageAlignSection = resources.size() > 1;
+	// the direct writer puts all payloads into one section
+	bool sectionPerResource = DataSections && resources.size() > 1;
+	if (useDirectObjectWriter() && !sectionPerResource) {
+		PhaseStats::Scope phase("write_direct", resources.size() == 1 ? resources.front().path : "");
+		writeObjectFileDirect(resources, objFile.os(), MArch, index, pageAlignSection);
+		phase.setBytes(objFile.os().tell());
 	}
+	else {
+		compileResources(resources, mod, pageAlignSection);
+		if (index) {
+			addIndexToModule(*index, resources, mod);
+		}
+		generateObjectFile(mod, objFile, MArch);
+	}
+	objFile.os().flush();
+}
 
-	CommonOptionsParser op(argCnt, args.data(), ToolingResCompCategory,
-R"__(Resource compiler
-Converts one ore more files into a linkable object file
-or a static library based on C++ header declarations.
-)__");
+// Static libraries split into several objects get the index as a separate member,
+// which refers to the storage of all resources through external symbols
+static void emitIndexObject(ArrayRef<ResourceEntry> resources, llvm::ToolOutputFile& objFile) {
+	llvm::LLVMContext ctxt;
+	llvm::Module mod("resource_index", ctxt);
+	addIndexToModule(buildResourceIndex(resources), resources, mod);
+	llvm::verifyModule(mod);
+	generateObjectFile(mod, objFile, MArch);
+	objFile.os().flush();
+}
+
+// Split resources into shards of roughly equal byte size (largest first, each to the lightest shard)
+static std::vector<std::vector<ResourceEntry>> shardResources(const std::vector<ResourceEntry>& resources, unsigned shardCount) {
+	std::vector<uint64_t> sizes(resources.size());
+	for (size_t i = 0; i < resources.size(); ++i) {
+		llvm::sys::fs::file_size(resources[i].path, sizes[i]); // unreadable files get reported when emitted
+	}
+
+	std::vector<size_t> order(resources.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return sizes[a] > sizes[b];
+	});
+
+	std::vector<std::vector<ResourceEntry>> shards(shardCount);
+	std::vector<uint64_t> shardSizes(shardCount);
+	for (size_t i : order) {
+		auto lightest = std::min_element(shardSizes.begin(), shardSizes.end()) - shardSizes.begin();
+		shards[lightest].push_back(resources[i]);
+		shardSizes[lightest] += sizes[i];
+	}
+	return shards;
+}
+
+// Run task(0) ... task(count - 1) on a worker pool and rethrow the first error on the calling thread.
+// With a single job the tasks run on the calling thread, which keeps its target machine.
+template <typename F>
+static void runParallel(size_t count, unsigned jobs, F task) {
+	std::vector<std::exception_ptr> errors(count);
+	auto runTask = [&](size_t i) {
+		// exceptions must not escape into the thread pool
+		try {
+			task(i);
+		}
+		catch (...) {
+			errors[i] = std::current_exception();
+		}
+	};
+
+	if (jobs <= 1) {
+		for (size_t i = 0; i < count; ++i) {
+			runTask(i);
+		}
+	}
+	else {
+		llvm::ThreadPool pool(jobs);
+		for (size_t i = 0; i < count; ++i) {
+			pool.async([&, i] {
+				runTask(i);
+			});
+		}
+		pool.wait();
+	}
+
+	for (auto& error : errors) {
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+}
+
+// Emit each shard as a separate object file on a worker pool and pack them all into the static library.
+// Every shard gets its own LLVMContext because contexts cannot be shared between threads.
+// With -data-sections every resource is a shard, the linker only pulls in the members the program uses.
+static void emitShardedLib(const std::vector<ResourceEntry>& resources, const ObjOrLibPath& output, unsigned jobs) {
+	std::vector<std::vector<ResourceEntry>> shards;
+	if (DataSections) {
+		for (const auto& res : resources) {
+			shards.push_back({ res });
+		}
+	}
+	else {
+		shards = shardResources(resources, std::min<size_t>(jobs, resources.size()));
+	}
+
+	std::vector<std::unique_ptr<OutputObjFile>> objFiles;
+	std::vector<std::string> objPaths;
+	for (size_t i = 0; i < shards.size(); ++i) {
+		objFiles.push_back(std::make_unique<OutputObjFile>(output));
+		objPaths.push_back(objFiles.back()->path());
+	}
+
+	runParallel(shards.size(), jobs, [&](size_t i) {
+		llvm::LLVMContext ctxt;
+		llvm::Module mod("resources", ctxt);
+		emitObjectFile(shards[i], mod, *objFiles[i]);
+	});
+
+	if (GenIndex) {
+		objFiles.push_back(std::make_unique<OutputObjFile>(output));
+		objPaths.push_back(objFiles.back()->path());
+		emitIndexObject(resources, *objFiles.back());
+	}
+
+	packIntoLib(objPaths, output.lib());
+	// The shard object files are deleted when objFiles go out of scope
+}
 
-	ClangTool tool(op.getCompilations(), op.getSourcePathList());
-	tool.appendArgumentsAdjuster(op.getArgumentsAdjuster());
+// Assemble the static library from cached single-resource objects, compiling only those which are missing
+static void emitCachedLib(const std::vector<ResourceEntry>& resources, const ObjOrLibPath& output, unsigned jobs) {
+	ObjectCache cache(CacheDir);
+	std::string targetId = getTargetId(MArch);
+	std::vector<std::string> objPaths(resources.size());
+
+	runParallel(resources.size(), jobs, [&](size_t i) {
+		const auto& res = resources[i];
+		std::string key = cache.computeKey(res, mapResourceFile(res)->getBuffer(), targetId);
+		objPaths[i] = cache.entryPath(key);
+
+		if (cache.contains(key)) {
+			return;
+		}
+
+		int fd;
+		std::string tempPath = cache.createTempFile(key, fd);
+		{
+			// the temporary file is removed if emitting fails
+			llvm::ToolOutputFile objFile(tempPath, fd);
+			llvm::LLVMContext ctxt;
+			llvm::Module mod("resources", ctxt);
+			emitObjectFile(res, mod, objFile);
+			objFile.keep();
+		}
+		cache.commit(key, tempPath);
+	});
+
+	// The index is cheap to generate and depends on all resources, so it is not cached
+	std::unique_ptr<OutputObjFile> indexFile;
+	if (GenIndex) {
+		indexFile = std::make_unique<OutputObjFile>(output);
+		objPaths.push_back(indexFile->path());
+		emitIndexObject(resources, *indexFile);
+	}
+
+	packIntoLib(objPaths, output.lib());
+}
+
+// Resources with byte-identical contents are emitted only once,
+// the storage symbols of the others become aliases of the first one.
+// The content hashes are kept for the storage_hash symbols.
+static std::vector<ResourceEntry> deduplicateResources(const std::vector<ResourceEntry>& resources, unsigned jobs) {
+	PhaseStats::Scope phase("deduplicate");
+	std::vector<std::pair<uint64_t, uint64_t>> hashes(resources.size()); // {size, hash}
+	runParallel(resources.size(), jobs, [&](size_t i) {
+		hashes[i] = contentHashes.get(resources[i]);
+	});
+
+	std::map<std::pair<uint64_t, uint64_t>, std::vector<size_t>> candidates; // -> indices into result
+	std::vector<ResourceEntry> result;
+	uint64_t duplicates = 0, bytesSaved = 0;
+
+	for (size_t i = 0; i < resources.size(); ++i) {
+		auto& sameHash = candidates[hashes[i]];
+		bool isDuplicate = false;
+
+		// confirm the match byte by byte, hashes may collide;
+		// compressed and uncompressed copies have different storage and cannot be merged
+		for (size_t j : sameHash) {
+			if (resources[i].compressed == result[j].compressed
+				&& mapResourceFile(resources[i])->getBuffer() == mapResourceFile(result[j])->getBuffer()) {
+				result[j].aliases.push_back({ resources[i].id, resources[i].declaredPath, resources[i].names });
+				result[j].alignment = std::max(result[j].alignment, resources[i].alignment);
+				duplicates++;
+				bytesSaved += hashes[i].first;
+				isDuplicate = true;
+				break;
+			}
+		}
+
+		if (!isDuplicate) {
+			sameHash.push_back(result.size());
+			result.push_back(resources[i]);
+			result.back().hash = hashes[i].second;
+		}
+	}
+
+	if (duplicates) {
+		// outputs of a batch are compiled concurrently
+		static std::mutex outputLock;
+		std::lock_guard<std::mutex> lock(outputLock);
+		llvm::outs() << "Deduplicated " << duplicates << " resource(s), saved " << bytesSaved << " bytes\n";
+	}
+	return result;
+}
+
+// Directory of the current user in the temporary directory, which other users can neither
+// read nor write, so they cannot plant cache entries. Empty if it cannot be set up.
+static std::string getPrivateTempDir() {
+	SmallString<260> dir;
+	llvm::sys::path::system_temp_directory(true, dir);
+#ifdef _WIN32
+	// the temporary directory is already private to the user
+	llvm::sys::path::append(dir, "rescomp");
+#else
+	llvm::sys::path::append(dir, "rescomp-" + std::to_string(::getuid()));
+	llvm::sys::fs::create_directory(dir, true, llvm::sys::fs::owner_all);
+	// the directory may have been created by someone else before
+	llvm::sys::fs::file_status status;
+	if (llvm::sys::fs::status(dir, status) || status.type() != llvm::sys::fs::file_type::directory_file
+		|| status.getUser() != ::getuid() || (status.permissions() & (llvm::sys::fs::group_all | llvm::sys::fs::others_all))) {
+		llvm::errs() << "warning: " << dir << " is not a private directory of the current user, use -cache-dir\n";
+		return {};
+	}
+#endif
+	return dir.str();
+}
+
+// Directory for one kind of cache entries, in -cache-dir or the private temporary directory.
+// Empty if there is no usable directory.
+static std::string getCacheSubdir(StringRef name) {
+	SmallString<260> dir;
+	if (CacheDir.empty()) {
+		dir = getPrivateTempDir();
+		if (dir.empty()) {
+			return {};
+		}
+		llvm::sys::path::append(dir, name);
+	}
+	else {
+		dir = makeAbsolute(CacheDir);
+		llvm::sys::path::append(dir, name);
+	}
+	return dir.str();
+}
 
-	tool.appendArgumentsAdjuster(
-		[perFileCmdLine = createPerFileCmdLine(getProgDir(argv[0]))]
+// Resources with transforms (declared options first, then matching -transform rules) are pointed
+// to their transformed contents in the cache, so everything after this stage works on those.
+static std::vector<ResourceEntry> transformResources(const std::vector<ResourceEntry>& resources,
+	const TransformCache& cache, unsigned jobs) {
+	std::vector<ResourceEntry> result(resources);
+	std::vector<size_t> pending;
+	for (size_t i = 0; i < result.size(); ++i) {
+		auto ruleTransforms = matchTransformRules(transformRules, result[i].declaredPath);
+		result[i].transforms.insert(result[i].transforms.end(), ruleTransforms.begin(), ruleTransforms.end());
+		if (!result[i].transforms.empty()) {
+			pending.push_back(i);
+		}
+	}
+	if (pending.empty()) {
+		return result;
+	}
+
+	runParallel(pending.size(), jobs, [&](size_t i) {
+		auto& res = result[pending[i]];
+		auto input = mapResourceFile(res);
+		res.path = cache.get(res.transforms, input->getBuffer(), res.path);
+	});
+	return result;
+}
+
+// Keeps the existing file, and its timestamp, if the new one has the same contents
+static void replaceIfChanged(const std::string& tempPath, const std::string& path) {
+	auto oldFile = llvm::MemoryBuffer::getFile(path, -1, false);
+	auto newFile = llvm::MemoryBuffer::getFile(tempPath, -1, false);
+	if (oldFile && newFile && (*oldFile)->getBuffer() == (*newFile)->getBuffer()) {
+		llvm::sys::fs::remove(tempPath);
+		return;
+	}
+
+	if (auto errc = llvm::sys::fs::rename(tempPath, path)) {
+		llvm::sys::fs::remove(tempPath);
+		throw llvm_ec_error(errc, "Cannot open output file: ");
+	}
+}
+
+// The program reads the pack header and slots directly, so they are written in its byte order
+static bool isTargetLittleEndian() {
+	llvm::Triple target(llvm::sys::getDefaultTargetTriple());
+	auto arch = llvm::Triple::getArchTypeForLLVMName(MArch);
+	if (!MArch.empty() && arch != llvm::Triple::UnknownArch) {
+		target.setArch(arch);
+	}
+	return target.isLittleEndian();
+}
+
+// Payloads go into the pack file, the loader object next to it only defines their symbols.
+// The object changes only when the layout of the pack does, so changing the contents
+// of resources does not require the program to be relinked.
+static void emitPack(const std::vector<ResourceEntry>& resources, const ObjOrLibPath& output, unsigned jobs) {
+	std::vector<std::unique_ptr<llvm::MemoryBuffer>> payloads(resources.size());
+	std::vector<uint64_t> payloadSizes(resources.size()), rawSizes(resources.size());
+	runParallel(resources.size(), jobs, [&](size_t i) {
+		payloads[i] = loadPayload(resources[i]);
+		payloadSizes[i] = payloads[i]->getBufferSize();
+		rawSizes[i] = resources[i].compressed ? mapResourceFile(resources[i])->getBufferSize() : 0;
+	});
+
+	PackLayout previous;
+	bool littleEndian = isTargetLittleEndian();
+	bool hasPrevious = readPackLayout(output.pack(), littleEndian, previous);
+	auto layout = layoutPack(resources, payloadSizes, rawSizes, hasPrevious ? &previous : nullptr);
+
+	int fd;
+	SmallString<260> tempPath;
+	if (auto errc = llvm::sys::fs::createUniqueFile(output.obj() + "-%%%%%%%.tmp", fd, tempPath)) {
+		throw llvm_ec_error(errc, "Cannot open output file: ");
+	}
+	{
+		// the temporary file is removed if emitting fails
+		llvm::ToolOutputFile objFile(tempPath, fd);
+		llvm::LLVMContext ctxt;
+		llvm::Module mod("resource_pack", ctxt);
+		addPackLoaderToModule(layout, resources, PackRuntimePath.empty() ? llvm::sys::path::filename(output.pack()).str() : PackRuntimePath, mod);
+		if (GenIndex) {
+			addIndexToModule(buildResourceIndex(resources), resources, mod);
+		}
+		llvm::verifyModule(mod);
+		generateObjectFile(mod, objFile, MArch);
+		objFile.os().flush();
+		objFile.keep();
+	}
+
+	std::vector<StringRef> payloadData;
+	for (const auto& payload : payloads) {
+		payloadData.push_back(payload->getBuffer());
+	}
+	writePackFile(output.pack(), littleEndian, layout, payloadData);
+	replaceIfChanged(tempPath.str(), output.obj());
+}
+
+// Returns the resources as emitted, after deduplication
+static std::vector<ResourceEntry> emitOutput(RescompContext& resCtxt, const std::vector<ResourceEntry>& transformed,
+	const ObjOrLibPath& output, unsigned jobs) {
+	auto resources = deduplicateResources(transformed, jobs);
+
+	if (!CacheDir.empty()) {
+		if (output.isLib()) {
+			emitCachedLib(resources, output, jobs);
+			return resources;
+		}
+		// the precompiled header and transformed contents are cached for every kind of output
+		bool hasTransforms = std::any_of(transformed.begin(), transformed.end(), [](const ResourceEntry& res) {
+			return !res.transforms.empty();
+		});
+		if (!UsePCH && PCHIncludes.empty() && !hasTransforms) {
+			llvm::errs() << "warning: -cache-dir only caches compiled resources for static library output\n";
+		}
+	}
+
+	if (output.isPack()) {
+		emitPack(resources, output, jobs);
+		return resources;
+	}
+
+	if (output.isLib() && (jobs > 1 || DataSections) && resources.size() > 1) {
+		emitShardedLib(resources, output, jobs);
+		return resources;
+	}
+
+	// objFile will have a randomized name in case we're generating static lib
+	OutputObjFile objFile{output};
+	if (GenIndex) {
+		auto index = buildResourceIndex(resources);
+		emitObjectFile(resources, resCtxt.getModule(), objFile, &index);
+	}
+	else {
+		emitObjectFile(resources, resCtxt.getModule(), objFile);
+	}
+
+	if (output.isLib()) {
+		packIntoLib(objFile.path(), output.lib());
+		// If a client specifies he only wants the static lib,
+		// not calling `keep` will cause the object file to be deleted.
+	}
+	else { // On the other hand, if object file was specified, we do want to keep it.
+		objFile.keep();
+	}
+	return resources;
+}
+
+// The header is only replaced if it changes, so that sources including it are not rebuilt needlessly.
+// It describes the resources as emitted: duplicates share the storage of the first one,
+// aligned to the largest alignment any of them asked for, and report that alignment at runtime.
+static void emitTraitsHeader(const std::vector<ResourceEntry>& emitted, const std::string& path, unsigned jobs) {
+	std::vector<ResourceEntry> resources;
+	for (const auto& res : emitted) {
+		resources.push_back(res);
+		for (const auto& alias : res.aliases) {
+			resources.push_back(res);
+			resources.back().id = alias.id;
+			resources.back().declaredPath = alias.declaredPath;
+			resources.back().names = alias.names;
+		}
+	}
+
+	std::vector<std::pair<uint64_t, uint64_t>> sizesAndHashes(resources.size());
+	runParallel(resources.size(), jobs, [&](size_t i) {
+		sizesAndHashes[i] = contentHashes.get(resources[i]);
+	});
+
+	int fd;
+	SmallString<260> tempPath;
+	if (auto errc = llvm::sys::fs::createUniqueFile(path + "-%%%%%%%.tmp", fd, tempPath)) {
+		throw llvm_ec_error(errc, "Cannot open traits header: ");
+	}
+	{
+		llvm::ToolOutputFile header(tempPath, fd);
+		writeTraitsHeader(header.os(), resources, sizesAndHashes, TraitsInlineLimit);
+		header.os().flush();
+		header.keep();
+	}
+	replaceIfChanged(tempPath.str(), path);
+}
+
+// One output with its inputs and search paths, batch mode compiles many of them in one process
+struct OutputJob {
+	std::string output;
+	std::vector<std::string> inputs;
+	std::vector<std::string> resSearchPath;
+	std::vector<std::string> hdrSearchPath;
+};
+
+// Each line of the manifest lists the output, its inputs and search paths like the command line,
+// -R and -I given on the command line are appended to those of every output
+static std::vector<OutputJob> readBatchManifest(const std::string& path) {
+	auto buffer = llvm::MemoryBuffer::getFile(path);
+	if (!buffer) {
+		throw llvm_ec_error(buffer.getError(), "Cannot read batch manifest: ");
+	}
+
+	std::vector<OutputJob> jobs;
+	llvm::SmallVector<StringRef, 64> lines;
+	(*buffer)->getBuffer().split(lines, '\n');
+
+	for (size_t lineIndex = 0; lineIndex < lines.size(); ++lineIndex) {
+		StringRef line = lines[lineIndex].trim();
+		if (line.empty() || line.startswith("#")) {
+			continue;
+		}
+
+		auto lineError = [&](const std::string& msg) {
+			return llvm_string_error(path + ":" + std::to_string(lineIndex + 1) + ": " + msg, "Invalid batch manifest: ");
+		};
+
+		llvm::BumpPtrAllocator alloc;
+		llvm::StringSaver saver(alloc);
+		llvm::SmallVector<const char*, 16> args;
+		llvm::cl::TokenizeGNUCommandLine(line, saver, args);
+
+		OutputJob job;
+		for (size_t i = 0; i < args.size(); ++i) {
+			StringRef arg = args[i];
+			if (arg == "-o" || arg == "-R" || arg == "-I") {
+				if (i + 1 == args.size()) {
+					throw lineError("missing value of " + arg.str());
+				}
+				std::string value = args[++i];
+				if (arg == "-o") {
+					job.output = value;
+				}
+				else {
+					(arg == "-R" ? job.resSearchPath : job.hdrSearchPath).push_back(value);
+				}
+			}
+			else if (arg.startswith("-")) {
+				throw lineError("unknown option " + arg.str());
+			}
+			else {
+				job.inputs.push_back(arg.str());
+			}
+		}
+
+		if (job.output.empty() || job.inputs.empty()) {
+			throw lineError("an output (-o) and at least one input are required");
+		}
+		job.resSearchPath.insert(job.resSearchPath.end(), ResSearchPath.begin(), ResSearchPath.end());
+		job.hdrSearchPath.insert(job.hdrSearchPath.end(), HdrSearchPath.begin(), HdrSearchPath.end());
+		jobs.push_back(std::move(job));
+	}
+	return jobs;
+}
+
+// Resolves an include of resman.h by a scanned header the way Clang's header search would:
+// the directory of the header for quoted includes, then the -I paths in command line order
+static bool findScannedInclude(bool angled, StringRef headerDir, ArrayRef<std::string> includePaths, std::string& path) {
+	std::vector<StringRef> dirs;
+	if (!angled) {
+		dirs.push_back(headerDir);
+	}
+	dirs.insert(dirs.end(), includePaths.begin(), includePaths.end());
+
+	for (StringRef dir : dirs) {
+		SmallString<260> candidate{dir};
+		llvm::sys::path::append(candidate, "resman.h");
+		if (llvm::sys::fs::is_regular_file(candidate)) {
+			path = makeAbsolute(candidate);
+			return true;
+		}
+	}
+	return false;
+}
+
+// The scanner only knows the Itanium mangling and the defaults of the Clang driver
+static bool canScanDeclarations(bool hasCompilerArgs) {
+	return !FullParse && !hasCompilerArgs
+		&& !llvm::Triple(llvm::sys::getDefaultTargetTriple()).isWindowsMSVCEnvironment();
+}
+
+// Fast path for outputs whose headers only contain canonical declarations.
+// Nothing is added to the context unless every header could be scanned, all resource files
+// were found and all IDs are unique; otherwise the whole output goes through Clang,
+// which reports any errors with its usual diagnostics.
+static bool scanInputs(const OutputJob& job, StringRef progDir, RescompContext& resCtxt) {
+	std::vector<std::string> includePaths{ progDir.str() };
+	includePaths.insert(includePaths.end(), job.hdrSearchPath.begin(), job.hdrSearchPath.end());
+
+	std::vector<ResourceEntry> resources;
+	std::set<std::string> headers;
+	std::set<uint64_t> ids;
+	for (const auto& input : job.inputs) {
+		std::string headerPath = makeAbsolute(input);
+		PhaseStats::Scope phase("scan", headerPath);
+		auto contents = llvm::MemoryBuffer::getFile(headerPath, -1, false);
+		ScannedHeader scanned;
+		if (!contents || !scanResourceHeader((*contents)->getBuffer(), scanned)) {
+			return false;
+		}
+		phase.setBytes((*contents)->getBufferSize());
+
+		std::string headerDir = removeFilename(headerPath);
+		headers.insert(headerPath);
+		if (scanned.includesResman) {
+			std::string resmanPath;
+			if (!findScannedInclude(scanned.angledInclude, headerDir, includePaths, resmanPath)) {
+				return false;
+			}
+			headers.insert(resmanPath);
+		}
+
+		// the same search path as ResCompFrontendAction uses
+		std::vector<StringRef> searchPath(job.resSearchPath.begin(), job.resSearchPath.end());
+		searchPath.push_back(headerDir);
+		for (const auto& res : scanned.resources) {
+			auto expectedPath = findResourceFile(res.declaredPath, searchPath);
+			if (!expectedPath) {
+				llvm::consumeError(expectedPath.takeError());
+				return false;
+			}
+			if (!ids.insert(res.id).second) {
+				return false;
+			}
+			resources.push_back({ res.id, *expectedPath, res.declaredPath, getItaniumStorageNames(res.id), false,
+				std::max<uint64_t>(1, MinAlignment) });
+		}
+	}
+
+	resCtxt.getResources() = std::move(resources);
+	resCtxt.getHeaders() = std::move(headers);
+	return true;
+}
+
+struct SharedPCH {
+	std::string path; // empty if there is none
+	std::string resmanPath;
+	std::vector<std::string> headers; // absolute paths of the headers it contains
+};
+
+// Loads the precompiled header on an empty file, fails if Clang does not accept it,
+// e.g. because one of the headers it was built from has changed since
+static bool probePCH(const std::string& pchPath, const std::string& dir, const CompilationDatabase& compilations,
+	const ArgumentsAdjuster& adjuster) {
+	SmallString<260> probePath{dir};
+	llvm::sys::path::append(probePath, "probe.h");
+
+	ClangTool tool(compilations, { probePath.str() });
+	tool.mapVirtualFile(probePath, "");
+	tool.appendArgumentsAdjuster(adjuster);
+	tool.appendArgumentsAdjuster(getInsertArgumentAdjuster({ "-include-pch", pchPath }, ArgumentInsertPosition::END));
+	IgnoringDiagConsumer ignoreDiags;
+	tool.setDiagnosticConsumer(&ignoreDiags);
+
+	RescompContext resCtxt("probe");
+	return tool.run(newFrontendActionFactoryFromLambda([&] {
+		return new ResCompFrontendAction({}, resCtxt);
+	}).get()) == 0;
+}
+
+// Precompiled header with resman.h and the -pch-include headers, built once and reused
+// by all outputs and later runs. The key covers everything Clang checks before accepting it:
+// compiler version, target, arguments and the size and modification time of the headers.
+// An empty path is returned if it cannot be built, the inputs are then parsed without it.
+static SharedPCH getSharedPCH(const CompilationDatabase& compilations, const ArgumentsAdjuster& adjuster,
+	StringRef progDir, ArrayRef<std::string> hdrSearchPath) {
+	// outputs of a batch share it, the first one builds it
+	static std::mutex pchLock;
+	static std::map<uint64_t, SharedPCH> built;
+	std::lock_guard<std::mutex> lock(pchLock);
+	PhaseStats::Scope phase("pch");
+
+	SharedPCH pch;
+	std::vector<std::string> includePaths{ progDir.str() };
+	includePaths.insert(includePaths.end(), hdrSearchPath.begin(), hdrSearchPath.end());
+	if (!findScannedInclude(true, "", includePaths, pch.resmanPath)) {
+		return {};
+	}
+	pch.headers.push_back(pch.resmanPath);
+	for (const auto& header : PCHIncludes) {
+		pch.headers.push_back(makeAbsolute(header));
+	}
+
+	ContentHasher hasher;
+	auto hashField = [&](StringRef field) {
+		// every field is terminated so that adjacent fields cannot be confused
+		hasher.update(field);
+		hasher.update(StringRef("", 1));
+	};
+	hashField(getClangFullVersion());
+	hashField(llvm::sys::getDefaultTargetTriple());
+	for (const auto& arg : adjuster(compilations.getCompileCommands("rescomp-pch.h").front().CommandLine, "rescomp-pch.h")) {
+		hashField(arg);
+	}
+	for (const auto& header : pch.headers) {
+		FileStamp stamp;
+		if (!getFileStamp(header, stamp)) {
+			llvm::errs() << "warning: cannot find " << header << ", parsing without precompiled header\n";
+			return {};
+		}
+		hashField(header);
+		hashField(std::to_string(stamp.size));
+		hashField(std::to_string(stamp.mtime.time_since_epoch().count()));
+	}
+	uint64_t key = hasher.final();
+
+	// the server keeps the map, the file may have been deleted in the meantime
+	auto found = built.find(key);
+	if (found != built.end() && (found->second.path.empty() || llvm::sys::fs::exists(found->second.path))) {
+		return found->second;
+	}
+
+	SmallString<260> dir{getCacheSubdir("pch")};
+	if (dir.empty() || llvm::sys::fs::create_directories(dir)) {
+		return {};
+	}
+
+	std::string name = "resman-" + llvm::utohexstr(key);
+	SmallString<260> prefixPath{dir}, pchPath{dir};
+	llvm::sys::path::append(prefixPath, name + ".h");
+	llvm::sys::path::append(pchPath, name + ".pch");
+
+	if (!llvm::sys::fs::exists(pchPath) || !probePCH(pchPath.str(), dir.str(), compilations, adjuster)) {
+		// the PCH refers to the prefix header, it has to stay next to it unchanged
+		std::string prefix;
+		for (const auto& header : pch.headers) {
+			prefix += "#include \"" + header + "\"\n";
+		}
+		auto existing = llvm::MemoryBuffer::getFile(prefixPath);
+		if (!existing || (*existing)->getBuffer() != prefix) {
+			int fd;
+			SmallString<260> tempPath;
+			if (llvm::sys::fs::createUniqueFile(prefixPath + "-%%%%%%%.tmp", fd, tempPath)) {
+				return {};
+			}
+			{
+				llvm::raw_fd_ostream os(fd, true);
+				os << prefix;
+			}
+			if (llvm::sys::fs::rename(tempPath, prefixPath)) {
+				llvm::sys::fs::remove(tempPath);
+				return {};
+			}
+		}
+
+		// errors are reported when the inputs are parsed without it
+		ClangTool tool(compilations, { prefixPath.str() });
+		tool.appendArgumentsAdjuster(adjuster);
+		IgnoringDiagConsumer ignoreDiags;
+		tool.setDiagnosticConsumer(&ignoreDiags);
+		if (tool.run(newFrontendActionFactoryFromLambda([&] {
+			return new ResCompPCHAction(pchPath.str());
+		}).get())) {
+			llvm::errs() << "warning: cannot build precompiled header, parsing without it\n";
+			return built[key] = {};
+		}
+	}
+
+	pch.path = pchPath.str();
+	return built[key] = pch;
+}
+
+// Everything the parse results of an output depend on besides the contents of the parsed files
+static std::string getParseCacheKey(const OutputJob& job, const CompilationDatabase& compilations) {
+	SmallString<260> workingDir;
+	llvm::sys::fs::current_path(workingDir);
+
+	std::string key = workingDir.str();
+	auto append = [&](StringRef part) {
+		key += '\0';
+		key += part;
+	};
+	append(std::to_string(MinAlignment));
+	for (const auto& input : job.inputs) {
+		for (const auto& command : compilations.getCompileCommands(input)) {
+			for (const auto& arg : command.CommandLine) {
+				append(arg);
+			}
+		}
+	}
+	for (const auto& path : job.resSearchPath) {
+		append("-R");
+		append(path);
+	}
+	for (const auto& path : job.hdrSearchPath) {
+		append("-I");
+		append(path);
+	}
+	return key;
+}
+
+// An input next to its own copy of resman.h would include it a second time
+static bool canUsePCH(const OutputJob& job, const SharedPCH& pch) {
+	for (const auto& input : job.inputs) {
+		SmallString<260> localResman{ removeFilename(makeAbsolute(input)) };
+		llvm::sys::path::append(localResman, "resman.h");
+		bool same = false;
+		if (llvm::sys::fs::exists(localResman)
+			&& (llvm::sys::fs::equivalent(localResman, pch.resmanPath, same) || !same)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int compileOutput(const OutputJob& job, const CompilationDatabase& compilations,
+	const ArgumentsAdjuster& commonAdjuster, StringRef progDir, unsigned jobs) {
+	ClangTool tool(compilations, job.inputs);
+	auto adjuster = combineAdjusters(commonAdjuster,
+		[perFileCmdLine = createPerFileCmdLine(progDir, job.hdrSearchPath)]
 		(const CommandLineArguments& cmdArgs, StringRef) {
 			CommandLineArguments result(cmdArgs);
 			result.insert(result.end(), perFileCmdLine.cbegin(), perFileCmdLine.cend());
 			return result;
 		}
 	);
+	tool.appendArgumentsAdjuster(adjuster);
 
 	// contains llvm::Module for the output
 	// and a map of resource IDs to source location
 	RescompContext resCtxt("resources");
 
-	int returnCode = tool.run(newFrontendActionFactoryFromLambda([&] {
-		return new ResCompFrontendAction(ResSearchPath, resCtxt);
-	}).get());
+	std::string cacheKey = keepParsedInputs ? getParseCacheKey(job, compilations) : "";
+	if (!keepParsedInputs || !parseCache.lookup(cacheKey, resCtxt)) {
+		auto parseTime = std::chrono::system_clock::now();
+		if (!scanDeclarations || !scanInputs(job, progDir, resCtxt)) {
+			SharedPCH pch;
+			if (UsePCH || !PCHIncludes.empty()) {
+				pch = getSharedPCH(compilations, adjuster, progDir, job.hdrSearchPath);
+			}
+			if (!pch.path.empty() && canUsePCH(job, pch)) {
+				tool.appendArgumentsAdjuster(
+					getInsertArgumentAdjuster({ "-include-pch", pch.path }, ArgumentInsertPosition::END));
+				// the preprocessor does not enter the headers of the PCH, they are dependencies all the same
+				resCtxt.getHeaders().insert(pch.headers.begin(), pch.headers.end());
+			}
 
-	if (returnCode) {
-		//llvm::errs() << "No output generated.\n";
-		return returnCode;
-	}
+			int returnCode = tool.run(newFrontendActionFactoryFromLambda([&] {
+				return new ResCompFrontendAction(job.resSearchPath, resCtxt);
+			}).get());
 
-	llvm::verifyModule(resCtxt.getModule());
+			if (returnCode) {
+				//llvm::errs() << "No output generated.\n";
+				return returnCode;
+			}
+		}
+		if (keepParsedInputs) {
+			parseCache.store(cacheKey, resCtxt, parseTime);
+		}
+	}
 
 	try {
-		ObjOrLibPath output{OutputFilePath};
-		// objFile will have a randomized name in case we're generating static lib
-		OutputObjFile objFile{output};
+		ObjOrLibPath output{job.output};
 
-		generateObjectFile(resCtxt.getModule(), objFile, MArch);
-		objFile.os().flush();
+		if (DirectObj && output.isPack()) {
+			llvm::errs() << "warning: the loader object of a pack file is always generated by LLVM\n";
+		}
+		if (DirectObj && DataSections && !output.isLib() && !output.isPack()) {
+			llvm::errs() << "warning: object files with -data-sections are generated by LLVM, "
+				"static libraries can be written directly\n";
+		}
 
-		if (output.isLib()) {
-			packIntoLib(objFile.path(), output.lib());
-			// If a client specifies he only wants the static lib,
-			// not calling `keep` will cause the object file to be deleted.
+		// without -cache-dir, transformed contents only live until the outputs are written;
+		// the dependency file lists the original resource files and the files cmd: transforms use
+		TransformCache transformCache(CacheDir.empty() ? std::string() : getCacheSubdir("transform"));
+		auto resources = transformResources(resCtxt.getResources(), transformCache, jobs);
+		auto emitted = emitOutput(resCtxt, resources, output, jobs);
+
+		if (!TraitsHeaderPath.empty()) {
+			emitTraitsHeader(emitted, TraitsHeaderPath, jobs);
 		}
-		else { // On the other hand, if object file was specified, we do want to keep it.
-			objFile.keep();
+
+		if (GenDepFile || !DepFilePath.empty()) {
+			std::vector<std::string> deps(resCtxt.getHeaders().begin(), resCtxt.getHeaders().end());
+			for (const auto& res : resCtxt.getResources()) {
+				deps.push_back(res.path);
+			}
+			std::set<std::string> transforms;
+			for (const auto& res : resources) {
+				transforms.insert(res.transforms.begin(), res.transforms.end());
+			}
+			auto commandDeps = getTransformDependencies(std::vector<std::string>(transforms.begin(), transforms.end()));
+			deps.insert(deps.end(), commandDeps.begin(), commandDeps.end());
+			writeDepFile(DepFilePath.empty() ? job.output + ".d" : DepFilePath,
+				DepTarget.empty() ? job.output : DepTarget, deps);
 		}
 	}
 	catch (llvm_error& ex) {
@@ -494,3 +1677,222 @@ or a static library based on C++ header declarations.
 
 	return 0;
 }
+
+template <typename F>
+static void writeStatsFile(const std::string& path, F write) {
+	std::error_code errc;
+	llvm::raw_fd_ostream os(path, errc, llvm::sys::fs::F_Text);
+	if (errc) {
+		throw llvm_ec_error(errc, "Cannot open statistics file: ");
+	}
+	write(os);
+}
+
+std::string getProgDir(const char* argv0) {
+	return removeFilename(llvm::sys::fs::getMainExecutable(argv0, (void*)(intptr_t)getProgDir));
+}
+
+static int runServerMode(const char* argv0);
+
+// Runs one invocation, requests of clients run here too and parse the options again
+static int runRescomp(std::vector<const char*> args, bool isRequest) {
+	using namespace std::string_literals;
+
+	auto it = std::find(args.cbegin(), args.cend(), "--"s);
+	bool hasCompilerArgs = it != args.cend() && it + 1 != args.cend();
+	if (it == args.cend()) {
+		// We don't want to work with compilation databases.
+		// If the `--` option wasn't specified, pretend it was.
+		args.push_back("--");
+	}
+	int argCnt = static_cast<int>(args.size());
+
+	// CommonOptionsParser exits on invalid options, which must not terminate the server:
+	// the options of a request (up to `--`, as it splits them) are checked first
+	if (isRequest) {
+		int optionCnt = static_cast<int>(std::find(args.cbegin(), args.cend(), "--"s) - args.cbegin());
+		llvm::cl::ResetAllOptionOccurrences();
+		if (!llvm::cl::ParseCommandLineOptions(optionCnt, args.data(), "", &llvm::errs())) {
+			return 1;
+		}
+	}
+
+	// inputs are listed in the manifest in batch mode
+	CommonOptionsParser op(argCnt, args.data(), ToolingResCompCategory, llvm::cl::ZeroOrMore,
+R"__(Resource compiler
+Converts one ore more files into a linkable object file
+or a static library based on C++ header declarations.
+)__");
+
+	if (!ServerSocket.empty()) {
+		if (isRequest) {
+			llvm::errs() << "Error: -server cannot be forwarded to a server\n";
+			return 1;
+		}
+		return runServerMode(args[0]);
+	}
+
+	if (!llvm::isPowerOf2_32(MinAlignment)) {
+		llvm::errs() << "Error: -align must be a power of two\n";
+		return 1;
+	}
+
+	if (BatchManifest.empty() && (OutputFilePath.empty() || op.getSourcePathList().empty())) {
+		llvm::errs() << "Error: an output file (-o) and at least one input file are required\n";
+		return 1;
+	}
+	if (!BatchManifest.empty() && (!OutputFilePath.empty() || !op.getSourcePathList().empty())) {
+		llvm::errs() << "Error: -o and input files cannot be combined with -batch\n";
+		return 1;
+	}
+	if (!BatchManifest.empty() && (!DepFilePath.empty() || !DepTarget.empty())) {
+		llvm::errs() << "Error: -MF and -MT cannot be used with -batch, -MD writes <output>.d for every output\n";
+		return 1;
+	}
+	if (!BatchManifest.empty() && !TraitsHeaderPath.empty()) {
+		llvm::errs() << "Error: -traits-header cannot be used with -batch\n";
+		return 1;
+	}
+
+	try {
+		transformRules.clear();
+		for (const auto& rule : TransformRuleArgs) {
+			transformRules.push_back(parseTransformRule(rule));
+		}
+	}
+	catch (llvm_error& ex) {
+		llvm::logAllUnhandledErrors(std::move(ex.error()), llvm::errs(), ex.msg_prefix());
+		return 1;
+	}
+	// clients run these themselves, in their own environment (see mustRunLocally)
+	if (isRequest && std::any_of(transformRules.begin(), transformRules.end(),
+		[](const TransformRule& rule) { return runsCommand(rule.transforms); })) {
+		llvm::errs() << "Error: the server does not run cmd: transforms\n";
+		return 1;
+	}
+
+	if (DirectObj && !useDirectObjectWriter()) {
+		llvm::errs() << "warning: direct object writer does not support the target, using LLVM code generation\n";
+	}
+
+	if (!PhaseStatsPath.empty() || !PhaseTracePath.empty()) {
+		PhaseStats::get().enable();
+	}
+	else {
+		PhaseStats::get().disable();
+	}
+
+	scanDeclarations = canScanDeclarations(hasCompilerArgs);
+	std::string progDir = getProgDir(args[0]);
+	unsigned jobs = Jobs ? Jobs : llvm::hardware_concurrency();
+	int returnCode = 0;
+
+	if (BatchManifest.empty()) {
+		OutputJob job{ OutputFilePath, op.getSourcePathList(),
+			{ ResSearchPath.begin(), ResSearchPath.end() }, { HdrSearchPath.begin(), HdrSearchPath.end() } };
+		returnCode = compileOutput(job, op.getCompilations(), op.getArgumentsAdjuster(), progDir, jobs);
+	}
+	else {
+		std::vector<OutputJob> batch;
+		try {
+			batch = readBatchManifest(BatchManifest);
+		}
+		catch (llvm_error& ex) {
+			llvm::logAllUnhandledErrors(std::move(ex.error()), llvm::errs(), ex.msg_prefix());
+			return 1;
+		}
+
+		// Outputs are independent, they are compiled concurrently and each of them on a single thread.
+		// Targets, pass registry and target machines of the worker threads are shared by all outputs.
+		std::vector<int> results(batch.size());
+		runParallel(batch.size(), jobs, [&](size_t i) {
+			results[i] = compileOutput(batch[i], op.getCompilations(), op.getArgumentsAdjuster(), progDir, 1);
+		});
+
+		for (size_t i = 0; i < batch.size(); ++i) {
+			if (results[i]) {
+				llvm::errs() << "Error: failed to compile " << batch[i].output << '\n';
+				returnCode = 1;
+			}
+		}
+	}
+
+	try {
+		if (!PhaseStatsPath.empty()) {
+			writeStatsFile(PhaseStatsPath, [](llvm::raw_ostream& os) { PhaseStats::get().writeJson(os); });
+		}
+		if (!PhaseTracePath.empty()) {
+			writeStatsFile(PhaseTracePath, [](llvm::raw_ostream& os) { PhaseStats::get().writeChromeTrace(os); });
+		}
+	}
+	catch (llvm_error& ex) {
+		llvm::logAllUnhandledErrors(std::move(ex.error()), llvm::errs(), ex.msg_prefix());
+		return 1;
+	}
+
+	return returnCode;
+}
+
+// Parsed headers, hashes of resource contents and the target machine of the main thread
+// stay in memory between requests, a request with -j above 1 creates the target machines
+// of its worker threads again
+static int runServerMode(const char* argv0) {
+	std::string socketPath = ServerSocket;
+	keepParsedInputs = true;
+	try {
+		runServer(socketPath, [argv0](const std::vector<std::string>& requestArgs) {
+			std::vector<const char*> args{ argv0 };
+			for (const auto& arg : requestArgs) {
+				args.push_back(arg.c_str());
+			}
+			return runRescomp(args, true);
+		});
+	}
+	catch (llvm_error& ex) {
+		llvm::logAllUnhandledErrors(std::move(ex.error()), llvm::errs(), ex.msg_prefix());
+		return 1;
+	}
+	return 0;
+}
+
+// Help and version print and exit, a server is started here, these never go to the server.
+// Neither do cmd: transforms, the commands run as the client with its environment.
+static bool mustRunLocally(ArrayRef<const char*> args) {
+	bool transformValue = false;
+	for (StringRef arg : args) {
+		if (transformValue && arg.find("cmd:") != StringRef::npos) {
+			return true;
+		}
+		transformValue = false;
+		if (!arg.startswith("-")) {
+			continue;
+		}
+		arg = arg.ltrim('-');
+		if (arg.startswith("help") || arg == "version" || arg.startswith("server")) {
+			return true;
+		}
+		if (arg.consume_front("transform")) {
+			transformValue = arg.empty();
+			if (arg.startswith("=") && arg.find("cmd:") != StringRef::npos) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+int main(int argc, const char *argv[]) {
+	llvm::llvm_shutdown_obj shutdownOnExit;
+	std::vector<const char*> args(argv, argv + argc);
+
+	// the client does nothing else, without a server listening it compiles by itself
+	auto socketPath = llvm::sys::Process::GetEnv("RESCOMP_SERVER");
+	if (socketPath && !socketPath->empty() && !mustRunLocally(llvm::makeArrayRef(args).drop_front())) {
+		int exitCode;
+		if (forwardToServer(*socketPath, std::vector<std::string>(args.begin() + 1, args.end()), exitCode)) {
+			return exitCode;
+		}
+	}
+
+	return runRescomp(args, false);
+}